@@ -0,0 +1,92 @@
+#include <opentherm.h>
+#include <opentherm_emulator.h>
+
+// Benchmark settings
+#ifdef AVR
+#define MAX_BUSES 4           // every simulated bus takes ~200 bytes of RAM
+#else
+#define MAX_BUSES 64          // simulate up to this many buses
+#endif
+#define SIMULATED_TIME 3600000 // simulated bus time of each bus per run in millis (1 hour)
+
+// emulated thermostat and boiler of every simulated bus, exchanging frames over virtual bus
+OpenthermThermostat thermostats[MAX_BUSES];
+OpenthermBoiler boilers[MAX_BUSES];
+OpenthermVirtualBus buses[MAX_BUSES];
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+
+  Serial.println(F("Opentherm emulator and virtual bus benchmark"));
+  Serial.println();
+
+  for (byte count = 1; count <= MAX_BUSES; count *= 2) {
+    run(count);
+  }
+}
+
+void loop() {
+}
+
+/**
+ * Run given number of simulated buses for SIMULATED_TIME of bus time each and print throughput per bus and in total.
+ * Buses are interleaved as if they were served by single scheduler, the one that is the most behind goes next.
+ * Measured is cost of emulators, frame packing with parity check (encode/decode) and the scheduler itself,
+ * not the Manchester decoder that reads the line in timer interrupt.
+ */
+void run(byte count) {
+  for (byte i = 0; i < count; i++) {
+    thermostats[i] = OpenthermThermostat();
+    boilers[i] = OpenthermBoiler();
+    boilers[i].setFaults(1, 1, 1, 1); // exercise timeouts and error responses as well
+    boilers[i].setSeed(i + 1);
+    buses[i] = OpenthermVirtualBus();
+    buses[i].setNoise(1, i + 1); // and frames failing parity check
+  }
+
+  unsigned long start = micros();
+  while (true) {
+    byte next = 0;
+    for (byte i = 1; i < count; i++) {
+      if (buses[i].getTime() < buses[next].getTime()) {
+        next = i;
+      }
+    }
+    if (buses[next].getTime() >= SIMULATED_TIME) {
+      break; // all buses are done
+    }
+    buses[next].transaction(thermostats[next], boilers[next]);
+  }
+  unsigned long duration = micros() - start;
+
+  unsigned long frames = 0;
+  unsigned long errors = 0;
+  unsigned long timeouts = 0;
+  unsigned long unknown = 0;
+  for (byte i = 0; i < count; i++) {
+    frames += buses[i].getFrames();
+    errors += buses[i].getErrors();
+    timeouts += thermostats[i].getTimeouts();
+    unknown += thermostats[i].getUnknown();
+  }
+  float seconds = duration / 1000000.0;
+
+  Serial.print(count);
+  Serial.print(F(" buses: "));
+  Serial.print(frames);
+  Serial.print(F(" frames in "));
+  Serial.print(seconds, 3);
+  Serial.print(F("s, "));
+  Serial.print(frames / seconds, 0);
+  Serial.print(F(" frames/s total, "));
+  Serial.print(frames / seconds / count, 0);
+  Serial.print(F(" frames/s per bus, "));
+  Serial.print((float) SIMULATED_TIME * count / 1000 / seconds, 0);
+  Serial.print(F("x real time, timeouts: "));
+  Serial.print(timeouts);
+  Serial.print(F(", unknown: "));
+  Serial.print(unknown);
+  Serial.print(F(", errors: "));
+  Serial.println(errors);
+}
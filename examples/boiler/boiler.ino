@@ -0,0 +1,84 @@
+#include <opentherm.h>
+#include <opentherm_emulator.h>
+
+// Wemos D1 R1
+//#define THERMOSTAT_IN 16
+//#define THERMOSTAT_OUT 4
+
+// Wemos D1 R2
+//#define THERMOSTAT_IN 16
+//#define THERMOSTAT_OUT 4
+
+// Arduino UNO
+#define THERMOSTAT_IN 2
+#define THERMOSTAT_OUT 4
+
+// Wemos D1 R32
+// #define THERMOSTAT_IN 26
+// #define THERMOSTAT_OUT 17
+
+// Emulation settings
+#define RESPONSE_DELAY 100     // delay between request and response in millis, Opentherm allows 20-800ms
+#define FAULT_NO_RESPONSE 0    // percentage of requests left without response (master should time out)
+#define FAULT_LATE_RESPONSE 0  // percentage of requests responded after 800ms limit
+#define FAULT_DATA_INVALID 0   // percentage of supported requests responded with DataInvalid
+#define FAULT_BOILER 0         // percentage of status requests that raise boiler fault (cleared by next status request)
+
+OpenthermData request;
+OpenthermData response;
+OpenthermBoiler boiler;
+unsigned long requestTime = 0;
+long responseDelay = OT_NO_RESPONSE;
+
+void setup() {
+  pinMode(THERMOSTAT_IN, INPUT);
+  digitalWrite(THERMOSTAT_IN, HIGH); // pull up
+  digitalWrite(THERMOSTAT_OUT, HIGH);
+  pinMode(THERMOSTAT_OUT, OUTPUT); // low output = high current, high output = low current
+
+  Serial.begin(115200);
+
+  boiler.setResponseDelay(RESPONSE_DELAY);
+  boiler.setFaults(FAULT_NO_RESPONSE, FAULT_LATE_RESPONSE, FAULT_DATA_INVALID, FAULT_BOILER);
+  boiler.setSeed(analogRead(0));
+}
+
+/**
+ * Loop will act as emulated boiler (slave) connected to Opentherm thermostat or gateway.
+ * Requests are answered by OpenthermBoiler register model after its response delay, this sketch only moves frames
+ * between the line and the model. The same model runs in simulated time over OpenthermVirtualBus (see benchmark.ino).
+ */
+void loop() {
+  if (responseDelay != OT_NO_RESPONSE) {
+    if (millis() - requestTime >= (unsigned long) responseDelay) {
+      responseDelay = OT_NO_RESPONSE;
+      Serial.print(F("<- "));
+      OPENTHERM::printToSerial(response);
+      Serial.println();
+      OPENTHERM::send(THERMOSTAT_OUT, response);
+    }
+  }
+  else if (OPENTHERM::getMessage(request)) {
+    requestTime = millis();
+    OPENTHERM::stop();
+    Serial.print(F("-> "));
+    OPENTHERM::printToSerial(request);
+    Serial.println();
+
+    responseDelay = boiler.respond(request, response);
+    if (responseDelay == OT_NO_RESPONSE) {
+      Serial.println(F("<- (no response)"));
+    }
+    if (boiler.getRequests() % 100 == 0) {
+      Serial.print(F("Requests: "));
+      Serial.print(boiler.getRequests());
+      Serial.print(F(", unknown: "));
+      Serial.print(boiler.getUnknown());
+      Serial.print(F(", faults: "));
+      Serial.println(boiler.getFaults());
+    }
+  }
+  else if (OPENTHERM::isSent() || OPENTHERM::isIdle() || OPENTHERM::isError()) { // wait for request from thermostat
+    OPENTHERM::listen(THERMOSTAT_IN);
+  }
+}
@@ -0,0 +1,86 @@
+#include <opentherm.h>
+
+// Wemos D1 R1
+//#define THERMOSTAT_IN 16
+//#define BOILER_IN 5
+
+// Wemos D1 R2
+//#define THERMOSTAT_IN 16
+//#define BOILER_IN 5
+
+// Arduino UNO
+#define THERMOSTAT_IN 2
+#define BOILER_IN 3
+
+// Wemos D1 R32
+// #define THERMOSTAT_IN 26
+// #define BOILER_IN 25
+
+#define MODE_LISTEN_MASTER 0
+#define MODE_LISTEN_SLAVE 1
+
+OpenthermData request;
+OpenthermData response;
+volatile unsigned long frameTime = 0;
+unsigned long requestTime = 0;
+int mode = MODE_LISTEN_MASTER;
+
+void setup() {
+  // output pins are intentionally left untouched, monitor never drives the bus
+  pinMode(THERMOSTAT_IN, INPUT);
+  digitalWrite(THERMOSTAT_IN, HIGH); // pull up
+  pinMode(BOILER_IN, INPUT);
+  digitalWrite(BOILER_IN, HIGH); // pull up
+
+  Serial.begin(115200);
+}
+
+/**
+ * Loop will passively watch communication between Opentherm thermostat and boiler connected directly to each other.
+ * Unlike gateway.ino it never retransmits frames, so it adds neither delay nor point of failure to the heating system.
+ * Each response is paired with its request by data ID and response time limit and printed as single transaction
+ * together with measured response time (from end of request to start of response).
+ */
+void loop() {
+  if (mode == MODE_LISTEN_MASTER) {
+    if (OPENTHERM::getMessage(request)) {
+      requestTime = frameTime;
+      mode = MODE_LISTEN_SLAVE;
+      OPENTHERM::listen(BOILER_IN, 800, stampFrame); // response need to be send by boiler within 800ms
+    }
+    else if (OPENTHERM::isIdle() || OPENTHERM::isError()) {
+      OPENTHERM::listen(THERMOSTAT_IN, -1, stampFrame);
+    }
+  }
+  else if (mode == MODE_LISTEN_SLAVE) {
+    if (OPENTHERM::getMessage(response)) {
+      OPENTHERM::stop();
+      OPENTHERM::printToSerial(request);
+      if (response.id == request.id && (response.type & B100)) { // response type to the same data ID
+        Serial.print(F(" -> "));
+        OPENTHERM::printToSerial(response);
+        Serial.print(F(" ("));
+        Serial.print(frameTime - requestTime - 34UL * OPENTHERM::getPeerBitPeriod(BOILER_IN) / 1000); // minus 34 bits of response frame
+        Serial.println(F("ms)"));
+      }
+      else {
+        Serial.print(F(" -> unpaired "));
+        OPENTHERM::printToSerial(response);
+        Serial.println();
+      }
+      mode = MODE_LISTEN_MASTER;
+    }
+    else if (OPENTHERM::isError()) {
+      OPENTHERM::printToSerial(request);
+      Serial.println(F(" -> Timeout"));
+      mode = MODE_LISTEN_MASTER;
+    }
+  }
+}
+
+/**
+ * Called when frame is received, records time of its end for response time measurement.
+ */
+void stampFrame() {
+  frameTime = millis();
+}
@@ -0,0 +1,85 @@
+#include <opentherm.h>
+#include <opentherm_emulator.h>
+
+// Wemos D1 R1
+//#define BOILER_IN 5
+//#define BOILER_OUT 14
+
+// Wemos D1 R2
+//#define BOILER_IN 5
+//#define BOILER_OUT 0
+
+// Arduino UNO
+#define BOILER_IN 3
+#define BOILER_OUT 5
+
+// Wemos D1 R32
+// #define BOILER_IN 25
+// #define BOILER_OUT 16
+
+// Emulation settings
+#define FRAME_SPACING 100   // minimal delay between end of response and next request in millis
+#define STATS_INTERVAL 60000 // print statistics every minute
+
+OpenthermData message;
+OpenthermThermostat thermostat;
+unsigned long responseTime = 0;
+unsigned long statsTime = 0;
+
+void setup() {
+  pinMode(BOILER_IN, INPUT);
+  digitalWrite(BOILER_IN, HIGH); // pull up
+  digitalWrite(BOILER_OUT, HIGH);
+  pinMode(BOILER_OUT, OUTPUT); // low output = high voltage, high output = low voltage
+
+  Serial.begin(115200);
+}
+
+/**
+ * Loop will act as emulated thermostat (master) connected to Opentherm boiler or gateway.
+ * Requests are picked by OpenthermThermostat poll mix of status, setpoints and sensor reads, this sketch only moves frames
+ * between the line and the model and prints bus statistics every minute. The same model runs in simulated time over
+ * OpenthermVirtualBus (see benchmark.ino).
+ */
+void loop() {
+  if (OPENTHERM::isIdle()) {
+    if (millis() - responseTime >= FRAME_SPACING) {
+      thermostat.request(message, millis());
+      OPENTHERM::send(BOILER_OUT, message); // send message to boiler
+    }
+  }
+  else if (OPENTHERM::isSent()) {
+    OPENTHERM::listen(BOILER_IN, 800); // wait for boiler to respond
+  }
+  else if (OPENTHERM::getMessage(message)) { // boiler responded
+    OPENTHERM::stop();
+    responseTime = millis();
+    thermostat.response(message, responseTime);
+  }
+  else if (OPENTHERM::isError()) {
+    OPENTHERM::stop();
+    responseTime = millis();
+    thermostat.timeout();
+  }
+
+  if (millis() - statsTime >= STATS_INTERVAL) {
+    statsTime = millis();
+    printStats();
+  }
+}
+
+void printStats() {
+  Serial.print(F("Transactions: "));
+  Serial.print(thermostat.getTransactions());
+  Serial.print(F(", timeouts: "));
+  Serial.print(thermostat.getTimeouts());
+  Serial.print(F(", unknown: "));
+  Serial.print(thermostat.getUnknown());
+  Serial.print(F(", invalid: "));
+  Serial.print(thermostat.getInvalid());
+  Serial.print(F(", avg response: "));
+  Serial.print(thermostat.getAvgResponseTime());
+  Serial.print(F("ms, max response: "));
+  Serial.print(thermostat.getMaxResponseTime());
+  Serial.println(F("ms"));
+}
@@ -0,0 +1,132 @@
+#include <opentherm.h>
+#include <EEPROM.h>
+
+// Wemos D1 R1
+//#define BOILER_IN 5
+//#define BOILER_OUT 14
+
+// Wemos D1 R2
+//#define BOILER_IN 5
+//#define BOILER_OUT 0
+
+// Arduino UNO
+#define BOILER_IN 3
+#define BOILER_OUT 5
+
+// Wemos D1 R32
+// #define BOILER_IN 25
+// #define BOILER_OUT 16
+
+#define CAPABILITIES_ADDRESS 0 // EEPROM address of capability map
+#define SAVE_INTERVAL 600000 // save learned changes at most every 10 minutes to spare EEPROM
+#define FINGERPRINT_PROBES 3 // give up asking for fingerprint data ID that boiler does not respond to
+
+OpenthermData message;
+OpenthermCapabilities capabilities;
+bool statusTurn = false;
+byte nextId = 0;
+const byte fingerprintIds[] = {OT_MSGID_SLAVE_CONFIG, OT_MSGID_OT_VERSION_SLAVE, OT_MSGID_VERSION_SLAVE};
+byte fingerprintProbes[] = {0, 0, 0};
+unsigned long saveTime = 0;
+
+void setup() {
+  pinMode(BOILER_IN, INPUT);
+  digitalWrite(BOILER_IN, HIGH); // pull up
+  digitalWrite(BOILER_OUT, HIGH);
+  pinMode(BOILER_OUT, OUTPUT); // low output = high voltage, high output = low voltage
+
+  Serial.begin(115200);
+
+#if defined(ESP8266) || defined(ESP32)
+  EEPROM.begin(OT_CAPABILITIES_SIZE);
+#endif
+  if (capabilities.load(CAPABILITIES_ADDRESS, readEEPROM)) {
+    Serial.println(F("Capability map restored"));
+  }
+  else {
+    Serial.println(F("No capability map, probing boiler"));
+  }
+}
+
+/**
+ * Loop will act as thermostat (master) that learns which data IDs are supported by boiler.
+ * Status is requested every other transaction, remaining transactions walk over all data IDs skipping those known to be unsupported.
+ * With capability map restored from EEPROM unsupported data IDs are skipped right after reboot instead of being probed again.
+ */
+void loop() {
+  if (OPENTHERM::isIdle()) {
+    nextRequest(message);
+    OPENTHERM::send(BOILER_OUT, message); // send message to boiler
+  }
+  else if (OPENTHERM::isSent()) {
+    OPENTHERM::listen(BOILER_IN, 800); // wait for boiler to respond
+  }
+  else if (OPENTHERM::getMessage(message)) { // boiler responded
+    OPENTHERM::stop();
+    capabilities.update(message);
+    if (message.id != OT_MSGID_STATUS) {
+      Serial.print(F("<- "));
+      OPENTHERM::printToSerial(message);
+      Serial.println();
+    }
+    delay(100); // minimal delay before next communication
+  }
+  else if (OPENTHERM::isError()) {
+    OPENTHERM::stop();
+    Serial.println(F("<- Timeout"));
+  }
+
+  if (capabilities.isChanged() && millis() - saveTime >= SAVE_INTERVAL) {
+    saveTime = millis();
+    if (capabilities.save(CAPABILITIES_ADDRESS, writeEEPROM)) {
+#if defined(ESP8266) || defined(ESP32)
+      EEPROM.commit();
+#endif
+      Serial.println(F("Capability map saved"));
+    }
+  }
+}
+
+void nextRequest(OpenthermData &data) {
+  data.type = OT_MSGTYPE_READ_DATA;
+  data.valueHB = 0;
+  data.valueLB = 0;
+
+  statusTurn = !statusTurn;
+  if (statusTurn) {
+    data.id = OT_MSGID_STATUS;
+    data.valueHB = 0x03; // CH and DHW enabled
+    return;
+  }
+
+  // slave fingerprint first so stale map is detected as soon as possible, but only few times so that
+  // data ID boiler never responds to does not block the others (it is still requested in regular walk below)
+  for (byte i = 0; i < sizeof(fingerprintIds); i++) {
+    if (!capabilities.isVerified(fingerprintIds[i]) && fingerprintProbes[i] < FINGERPRINT_PROBES) {
+      fingerprintProbes[i]++;
+      data.id = fingerprintIds[i];
+      return;
+    }
+  }
+
+  // skip data IDs boiler does not support, those restored from EEPROM are not probed again
+  for (byte i = 0; i < 128; i++) {
+    nextId = (nextId + 1) & 0x7F;
+    if (capabilities.isSupported(nextId) && (!capabilities.isKnown(nextId) || capabilities.isReadable(nextId))) {
+      break;
+    }
+  }
+  data.id = nextId;
+}
+
+byte readEEPROM(int address) {
+  return EEPROM.read(address);
+}
+
+void writeEEPROM(int address, byte value) {
+#if defined(ESP8266) || defined(ESP32)
+  EEPROM.write(address, value); // marks EEPROM dirty only when value differs
+#else
+  EEPROM.update(address, value); // writes only when value differs
+#endif
+}
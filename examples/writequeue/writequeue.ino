@@ -0,0 +1,90 @@
+#include <opentherm.h>
+
+// Wemos D1 R1
+//#define BOILER_IN 5
+//#define BOILER_OUT 14
+
+// Wemos D1 R2
+//#define BOILER_IN 5
+//#define BOILER_OUT 0
+
+// Arduino UNO
+#define BOILER_IN 3
+#define BOILER_OUT 5
+
+// Wemos D1 R32
+// #define BOILER_IN 25
+// #define BOILER_OUT 16
+
+OpenthermData message;
+OpenthermData setpoint;
+OpenthermWriteQueue writes;
+bool statusTurn = false;
+unsigned long controlTime = 0;
+
+void setup() {
+  pinMode(BOILER_IN, INPUT);
+  digitalWrite(BOILER_IN, HIGH); // pull up
+  digitalWrite(BOILER_OUT, HIGH);
+  pinMode(BOILER_OUT, OUTPUT); // low output = high voltage, high output = low voltage
+
+  Serial.begin(115200);
+
+  writes.configure(OT_MSGID_CH_SETPOINT, 0.5, 10000); // ignore changes up to 0.5 C, refresh every 10s
+  writes.configure(OT_MSGID_DHW_SETPOINT, 0.5, 60000);
+  writes.configure(OT_MSGID_MAX_MODULATION_LEVEL, 1, 60000);
+}
+
+/**
+ * Loop will act as thermostat (master) whose control loop writes setpoints much more often than bus can carry.
+ * Writes go through write queue, so only changed values are sent and remaining bus slots are used to read feed temperature.
+ */
+void loop() {
+  if (millis() - controlTime >= 50) { // control loop iteration
+    controlTime = millis();
+    setpoint.id = OT_MSGID_CH_SETPOINT;
+    setpoint.f88(45 + (millis() / 1000 % 60) / 10.0); // slowly changing setpoint
+    writes.write(setpoint);
+    setpoint.id = OT_MSGID_DHW_SETPOINT;
+    setpoint.f88(50);
+    writes.write(setpoint);
+    setpoint.id = OT_MSGID_MAX_MODULATION_LEVEL;
+    setpoint.f88(100);
+    writes.write(setpoint);
+  }
+
+  if (OPENTHERM::isIdle()) {
+    statusTurn = !statusTurn;
+    if (statusTurn) {
+      message.type = OT_MSGTYPE_READ_DATA;
+      message.id = OT_MSGID_STATUS;
+      message.valueHB = 0x03; // CH and DHW enabled
+      message.valueLB = 0;
+    }
+    else if (!writes.next(message)) { // no write due, use slot for read
+      message.type = OT_MSGTYPE_READ_DATA;
+      message.id = OT_MSGID_FEED_TEMP;
+      message.valueHB = 0;
+      message.valueLB = 0;
+    }
+    Serial.print(F("-> "));
+    OPENTHERM::printToSerial(message);
+    Serial.println();
+    OPENTHERM::send(BOILER_OUT, message); // send message to boiler
+  }
+  else if (OPENTHERM::isSent()) {
+    OPENTHERM::listen(BOILER_IN, 800); // wait for boiler to respond
+  }
+  else if (OPENTHERM::getMessage(message)) { // boiler responded
+    OPENTHERM::stop();
+    writes.acknowledge(message);
+    Serial.print(F("<- "));
+    OPENTHERM::printToSerial(message);
+    Serial.println();
+    delay(100); // minimal delay before next communication
+  }
+  else if (OPENTHERM::isError()) {
+    OPENTHERM::stop();
+    Serial.println(F("<- Timeout"));
+  }
+}
@@ -9,10 +9,26 @@
 
 #define MODE_WRITE 4    // writing data with timer
 #define MODE_SENT 5     // all data written to output
+#define MODE_SKIP 6     // invalid data frame, waiting for its end to measure its length
 
 #define MODE_ERROR_MANCH 8  // manchester protocol data transfer error
 #define MODE_ERROR_TOUT 9   // read timeout
 
+#define BIT_PERIOD 1000      // nominal Opentherm bit period in micros
+#define SAMPLE_PERIOD 200    // read timer period in micros (5kHz)
+#define RX_BIT_TICKS 80      // nominal bit period in 1/16 of read timer ticks (5 samples per bit)
+#define RX_BIT_PERIOD_MIN 800  // shorter measured bit periods are ignored
+#define RX_BIT_PERIOD_MAX 1500 // longer measured bit periods are ignored
+#define TX_BIT_PERIOD_MIN 800  // shortest bit period accepted by setBitPeriod()
+#define TX_BIT_PERIOD_MAX 1500 // longest bit period accepted by setBitPeriod()
+#define MATCH_BIT_PERIOD_MIN 900  // bit period matched to peer is kept within range Opentherm devices must accept
+#define MATCH_BIT_PERIOD_MAX 1150
+#define FRAME_TRANSITIONS_MIN 34 // full frame has transition in the middle of every bit
+#define FRAME_TRANSITIONS_MAX 67 // and at most one more between each two bits
+#define IDLE_PERIOD_MIN 3500 // line without rising edge for this long (micros) is idle, frame has at most 2 bits between them (3000us at RX_BIT_PERIOD_MAX)
+#define SKIP_TICKS_MAX 300   // give up waiting for end of invalid frame
+#define DEADLINE_PERIOD 1000 // timer period in micros when deadline is already due
+
 byte OPENTHERM::_pin = 0;
 void (*OPENTHERM::_callback)() = NULL;
 
@@ -22,118 +38,360 @@ volatile byte OPENTHERM::_clock = 0;
 volatile byte OPENTHERM::_bitPos = 0;
 volatile unsigned long OPENTHERM::_data = 0;
 volatile bool OPENTHERM::_active = false;
-volatile int OPENTHERM::_timeoutCounter = -1;
+volatile bool OPENTHERM::_bitClock = false;
+volatile bool OPENTHERM::_timeout = false;
+volatile unsigned long OPENTHERM::_timeoutDeadline = 0;
+volatile unsigned long OPENTHERM::_lastFrameTime = 0;
+unsigned int OPENTHERM::_frameSpacing = 0;
+unsigned int OPENTHERM::_halfBitPeriod = BIT_PERIOD / 2;
+volatile unsigned long OPENTHERM::_timerPeriod = 0;
+bool OPENTHERM::_edgeAttached = false;
+void (* volatile OPENTHERM::_deadlineCallbacks[OT_DEADLINES])() = {NULL};
+volatile unsigned long OPENTHERM::_deadlines[OT_DEADLINES] = {0};
+volatile unsigned int OPENTHERM::_frameTicks = 0;
+volatile unsigned int OPENTHERM::_lastTransition = 0;
+volatile byte OPENTHERM::_transitions = 0;
+volatile bool OPENTHERM::_fullFrame = false;
+volatile bool OPENTHERM::_lineIdle = false;
+volatile unsigned long OPENTHERM::_listenTime = 0;
+volatile unsigned int OPENTHERM::_longCapture = 0xF;
+volatile unsigned int OPENTHERM::_maxCapture = 0xFF;
+byte OPENTHERM::_peerPins[OT_PEERS] = {0};
+unsigned int OPENTHERM::_peerBitPeriods[OT_PEERS] = {0};
+byte OPENTHERM::_peerNext = 0;
+byte OPENTHERM::_linkInputPins[OT_PEERS] = {0};
+byte OPENTHERM::_linkOutputPins[OT_PEERS] = {0};
+byte OPENTHERM::_linkCount = 0;
+unsigned int OPENTHERM::_txBitPeriod = BIT_PERIOD;
 
 #define STOP_BIT_POS 33
 
+// listen(), send() and stop() may be called from deadline callback as well, interrupts must stay as they were
 void OPENTHERM::listen(byte pin, int timeout, void (*callback)()) {
+  _initTimer();
+  unsigned long state = _disableInterrupts();
   _stop();
+  _restoreInterrupts(state);
+  _detachEdge();
   _pin = pin;
-  _timeoutCounter = timeout * 5; // timer ticks at 5 ticks/ms
+  _timeout = timeout >= 0;
+  _timeoutDeadline = millis() + timeout;
+  byte slot = _findPeer(pin);
+  _setRxBitTicks(slot < OT_PEERS ? _peerBitPeriods[slot] * 16 / SAMPLE_PERIOD : RX_BIT_TICKS); // use bit period measured earlier on this line
   _callback = callback;
 
+  // detect start of the frame by pin interrupt so timer does not need to run while line is idle
+  int interrupt = digitalPinToInterrupt(pin);
+  if (interrupt != NOT_AN_INTERRUPT) {
+    attachInterrupt(interrupt, OPENTHERM::_edgeISR, RISING);
+    _edgeAttached = true;
+  }
+
+  state = _disableInterrupts();
   _listen();
+  _lineIdle = false; // listen could start in the middle of frame
+  _schedule();
+  _restoreInterrupts(state);
 }
 
 void OPENTHERM::_listen() {
-  _stopTimer();
+  _listenTime = micros();
   _mode = MODE_LISTEN;
   _active = true;
   _data = 0;
   _bitPos = 0;
-
-  _startReadTimer();
+  _bitClock = !_edgeAttached; // pins without interrupt are polled at read timer rate
 }
 
 void OPENTHERM::send(byte pin, OpenthermData &data, void (*callback)()) {
+  _initTimer();
+  unsigned long state = _disableInterrupts();
   _stop();
+  _restoreInterrupts(state);
+  _detachEdge();
   _pin = pin;
   _callback = callback;
 
-  _data = data.type;
-  _data = (_data << 12) | data.id;
-  _data = (_data << 8) | data.valueHB;
-  _data = (_data << 8) | data.valueLB;
-  if (!_checkParity(_data)) {
-    _data = _data | 0x80000000;
-  }
+  _data = encode(data);
+  _halfBitPeriod = getBitPeriod(pin) / 2;
 
+  state = _disableInterrupts();
   _clock = 1; // clock starts at HIGH
   _bitPos = 33; // count down (33 == start bit, 32-1 data, 0 == stop bit)
   _mode = MODE_WRITE;
-
   _active = true;
-  _startWriteTimer();
+  _bitClock = (long)(millis() - _lastFrameTime) >= _frameSpacing; // otherwise started once frame spacing is over
+  _schedule();
+  _restoreInterrupts(state);
+}
+
+void OPENTHERM::setFrameSpacing(unsigned int spacing) {
+  _frameSpacing = spacing;
+}
+
+// may be called from deadline callback (inside timer interrupt), so interrupts must not be enabled on return
+bool OPENTHERM::setDeadline(unsigned long delay, void (*callback)()) {
+  bool scheduled = false;
+  _initTimer();
+  unsigned long state = _disableInterrupts();
+  for (byte i = 0; i < OT_DEADLINES; i++) {
+    if (_deadlineCallbacks[i] == callback) {
+      _deadlineCallbacks[i] = NULL; // reschedule
+    }
+  }
+  for (byte i = 0; i < OT_DEADLINES; i++) {
+    if (_deadlineCallbacks[i] == NULL) {
+      _deadlines[i] = millis() + delay;
+      _deadlineCallbacks[i] = callback;
+      scheduled = true;
+      break;
+    }
+  }
+  _schedule();
+  _restoreInterrupts(state);
+  return scheduled;
+}
+
+void OPENTHERM::cancelDeadline(void (*callback)()) {
+  unsigned long state = _disableInterrupts();
+  for (byte i = 0; i < OT_DEADLINES; i++) {
+    if (_deadlineCallbacks[i] == callback) {
+      _deadlineCallbacks[i] = NULL;
+    }
+  }
+  _schedule();
+  _restoreInterrupts(state);
+}
+
+void OPENTHERM::setBitPeriod(unsigned int period) {
+  _txBitPeriod = period > 0 ? constrain(period, TX_BIT_PERIOD_MIN, TX_BIT_PERIOD_MAX) : 0;
+}
+
+void OPENTHERM::linkPins(byte inputPin, byte outputPin) {
+  byte i = 0;
+  while (i < _linkCount && _linkOutputPins[i] != outputPin) {
+    i++;
+  }
+  if (i == OT_PEERS) {
+    i = OT_PEERS - 1; // all links in use, replace the last one
+  }
+  else if (i == _linkCount) {
+    _linkCount++;
+  }
+  _linkInputPins[i] = inputPin;
+  _linkOutputPins[i] = outputPin;
+}
+
+unsigned int OPENTHERM::getBitPeriod(byte pin) {
+  if (_txBitPeriod > 0) {
+    return _txBitPeriod;
+  }
+  unsigned int period = BIT_PERIOD;
+  byte linked = OT_PEERS;
+  for (byte i = 0; i < _linkCount; i++) {
+    if (_linkOutputPins[i] == pin) {
+      linked = i;
+    }
+  }
+  if (linked < OT_PEERS) {
+    period = getPeerBitPeriod(_linkInputPins[linked]);
+  }
+  else {
+    // without link the peer is known only if bit period was measured on single line
+    byte measured = 0;
+    for (byte i = 0; i < OT_PEERS; i++) {
+      if (_peerBitPeriods[i] > 0) {
+        measured++;
+        period = _peerBitPeriods[i];
+      }
+    }
+    if (measured != 1) {
+      period = BIT_PERIOD;
+    }
+  }
+  return constrain(period, MATCH_BIT_PERIOD_MIN, MATCH_BIT_PERIOD_MAX);
+}
+
+unsigned int OPENTHERM::getPeerBitPeriod(byte pin) {
+  byte slot = _findPeer(pin);
+  return slot < OT_PEERS ? _peerBitPeriods[slot] : BIT_PERIOD;
 }
 
 bool OPENTHERM::getMessage(OpenthermData &data) {
   if (_mode == MODE_RECEIVED) {
-    data.type = (_data >> 28) & 0x7;
-    data.id = (_data >> 16) & 0xFF;
-    data.valueHB = (_data >> 8) & 0xFF;
-    data.valueLB = _data & 0xFF;
-    return true;
+    return decode(_data, data);
   }
   return false;
 }
 
+unsigned long OPENTHERM::encode(OpenthermData &data) {
+  unsigned long frame = data.type;
+  frame = (frame << 12) | data.id;
+  frame = (frame << 8) | data.valueHB;
+  frame = (frame << 8) | data.valueLB;
+  if (!_checkParity(frame)) {
+    frame = frame | 0x80000000;
+  }
+  return frame;
+}
+
+bool OPENTHERM::decode(unsigned long frame, OpenthermData &data) {
+  if (!_checkParity(frame)) {
+    return false;
+  }
+  data.type = (frame >> 28) & 0x7;
+  data.id = (frame >> 16) & 0xFF;
+  data.valueHB = (frame >> 8) & 0xFF;
+  data.valueLB = frame & 0xFF;
+  return true;
+}
+
 void OPENTHERM::stop() {
+  unsigned long state = _disableInterrupts();
   _stop();
   _mode = MODE_IDLE;
+  _restoreInterrupts(state);
+  _detachEdge();
 }
 
 void OPENTHERM::_stop() {
   if (_active) {
-    _stopTimer();
     _active = false;
+    _bitClock = false;
+    _schedule(); // timer keeps running only for pending deadlines
+  }
+}
+
+// pin interrupt is left attached (and ignored) until next listen(), send() or stop()
+void OPENTHERM::_detachEdge() {
+  if (_edgeAttached) {
+    detachInterrupt(digitalPinToInterrupt(_pin));
+    _edgeAttached = false;
   }
 }
 
 void OPENTHERM::_read() {
+  // frame is measured only if line was idle before, listen could have started in the middle of frame
+  _fullFrame = _lineIdle || micros() - _listenTime >= IDLE_PERIOD_MIN;
+  _transitions = 0;
   _data = 0;
   _bitPos = 0;
   _mode = MODE_READ;
   _capture = 1; // reset counter and add as if read start bit
+  _frameTicks = 0;
+  _lastTransition = 0;
   _clock = 1; // clock is high at the start of comm
-  _startReadTimer(); // get us into 1/4 of manchester code
+  _bitClock = true;
+}
+
+void OPENTHERM::_edgeISR() {
+  if (_mode == MODE_LISTEN) { // pin interrupt stays attached during whole listen() but only start of frame matters
+    _read();
+    _timerPeriod = SAMPLE_PERIOD * 3 / 4; // first sample away from signal transitions, then regular sampling
+    _startTimer(_timerPeriod);
+  }
 }
 
 void OPENTHERM::_timerISR() {
-  if (_mode == MODE_LISTEN) {
-    if (_timeoutCounter == 0) {
-      _mode = MODE_ERROR_TOUT;
-      _stop();
-      return;
+  if (_bitClock) {
+    _bitTick();
+  }
+  _checkDeadlines();
+  _schedule();
+}
+
+void OPENTHERM::_checkDeadlines() {
+  unsigned long now = millis();
+  if (_mode == MODE_LISTEN && _timeout && (long)(now - _timeoutDeadline) >= 0) {
+    _mode = MODE_ERROR_TOUT;
+    _stop();
+  }
+  else if (_mode == MODE_WRITE && !_bitClock && now - _lastFrameTime >= _frameSpacing) {
+    _bitClock = true; // frame spacing is over, start sending
+  }
+  if (_bitClock && _mode != MODE_LISTEN) {
+    return; // frame is being read or written, user callbacks would shift its bit timing, they are called once it is over
+  }
+  for (byte i = 0; i < OT_DEADLINES; i++) {
+    void (*callback)() = _deadlineCallbacks[i];
+    if (callback != NULL && (long)(now - _deadlines[i]) >= 0) {
+      _deadlineCallbacks[i] = NULL;
+      callback();
     }
+  }
+}
+
+// timer period until given deadline or current period if it is sooner
+static unsigned long untilDeadline(unsigned long deadline, unsigned long now, unsigned long period) {
+  long remaining = deadline - now;
+  unsigned long wait = remaining > 0 ? min(remaining, 60000L) * 1000 : DEADLINE_PERIOD;
+  return (period == 0 || wait < period) ? wait : period;
+}
+
+// program timer for the next due event only: bit clock while there is bit activity, nearest deadline otherwise
+void OPENTHERM::_schedule() {
+  unsigned long period = 0; // no event, timer stopped
+  if (_bitClock) {
+    period = _mode == MODE_WRITE ? _halfBitPeriod : SAMPLE_PERIOD;
+  }
+  else {
+    unsigned long now = millis();
+    if (_active && _mode == MODE_LISTEN && _timeout) {
+      period = untilDeadline(_timeoutDeadline, now, period);
+    }
+    if (_active && _mode == MODE_WRITE) {
+      period = untilDeadline(_lastFrameTime + _frameSpacing, now, period);
+    }
+    for (byte i = 0; i < OT_DEADLINES; i++) {
+      if (_deadlineCallbacks[i] != NULL) {
+        period = untilDeadline(_deadlines[i], now, period);
+      }
+    }
+  }
+  if (period != _timerPeriod) {
+    _timerPeriod = period;
+    if (period > 0) {
+      _startTimer(period);
+    }
+    else {
+      _stopTimer();
+    }
+  }
+}
+
+void OPENTHERM::_bitTick() {
+  if (_mode == MODE_LISTEN) {
     byte value = digitalRead(_pin);
     if (value == 1) { // incoming data (rising signal)
       _read();
     }
-    if (_timeoutCounter > 0) {
-      _timeoutCounter --;
-    }
   }
   else if (_mode == MODE_READ) {
+    _frameTicks++;
     byte value = digitalRead(_pin);
     byte last = (_capture & 1);
     if (value != last) {
       // transition of signal from last sampling
-      if (_clock == 1 && _capture > 0xF) {
+      _lastTransition = _frameTicks;
+      _transitions++;
+      if (_clock == 1 && _capture > _longCapture) {
         // no transition in the middle of the bit
-        _listen();
+        _skip();
       }
-      else if (_clock == 1 || _capture > 0xF) {
+      else if (_clock == 1 || _capture > _longCapture) {
         // transition in the middle of the bit OR no transition between two bit, both are valid data points
         if (_bitPos == STOP_BIT_POS) {
           // expecting stop bit
           if (_verifyStopBit(last)) {
+            _calibrate();
             _mode = MODE_RECEIVED;
+            _lastFrameTime = millis();
             _stop();
             _callCallback();
           }
           else {
             // end of data not verified, invalid data
-            _listen();
+            _skip();
           }
         }
         else {
@@ -148,9 +406,32 @@ void OPENTHERM::_timerISR() {
       }
       _capture = 1; // reset counter
     }
-    else if (_capture > 0xFF) {
+    else if (_capture > _maxCapture) {
       // no change for too long, invalid mancheter encoding
+      _skip();
+    }
+    _capture = (_capture << 1) | value;
+  }
+  else if (_mode == MODE_SKIP) {
+    _frameTicks++;
+    byte value = digitalRead(_pin);
+    if (value != (_capture & 1)) {
+      _lastTransition = _frameTicks;
+      _transitions++;
+      _capture = 1;
+    }
+    else if (_capture > _maxCapture && value == 0) {
+      // line is idle, frame is over
+      _calibrate();
+      _listen();
+      _lineIdle = true;
+      return;
+    }
+    else if (_frameTicks > SKIP_TICKS_MAX) {
+      // line is stuck or noisy, start over
       _listen();
+      _lineIdle = false;
+      return;
     }
     _capture = (_capture << 1) | value;
   }
@@ -165,6 +446,7 @@ void OPENTHERM::_timerISR() {
     if (_clock == 0) {
       if (_bitPos <= 0) { // check termination
         _mode = MODE_SENT; // all data written
+        _lastFrameTime = millis();
         _stop();
         _callCallback();
       }
@@ -177,6 +459,57 @@ void OPENTHERM::_timerISR() {
   }
 }
 
+// invalid frame, skip the rest of it but keep measuring its length
+void OPENTHERM::_skip() {
+  _mode = MODE_SKIP;
+}
+
+// measure bit period of the peer over whole frame, that works even if frame was not decoded with current thresholds
+void OPENTHERM::_calibrate() {
+  if (!_fullFrame || _transitions < FRAME_TRANSITIONS_MIN || _transitions > FRAME_TRANSITIONS_MAX) {
+    return; // partial frame or noise, keep last good value
+  }
+  // last transition of the frame is in the middle of stop bit, that is 33.5 bits after start of the frame,
+  // it is sampled half of sample period late on average, so is polled start of the frame and these cancel out
+  unsigned long span = (unsigned long) _lastTransition * SAMPLE_PERIOD;
+  if (_edgeAttached) {
+    span -= SAMPLE_PERIOD * 3 / 4; // start of the frame caught by pin interrupt right away and first sample taken sooner
+  }
+  unsigned int period = (span * 2 + 33) / 67;
+  if (period < RX_BIT_PERIOD_MIN || period > RX_BIT_PERIOD_MAX) {
+    return;
+  }
+  byte slot = _findPeer(_pin);
+  if (slot < OT_PEERS) {
+    period = ((unsigned long) _peerBitPeriods[slot] * 3 + period + 2) / 4; // smooth out sampling jitter of single frames
+  }
+  else { // new line, replace the oldest one
+    slot = _peerNext;
+    _peerNext = (_peerNext + 1) % OT_PEERS;
+  }
+  _peerPins[slot] = _pin;
+  _peerBitPeriods[slot] = period;
+  _setRxBitTicks(period * 16 / SAMPLE_PERIOD);
+}
+
+// slot of given line in table of measured bit periods, OT_PEERS if bit period was not measured on it yet
+byte OPENTHERM::_findPeer(byte pin) {
+  for (byte i = 0; i < OT_PEERS; i++) {
+    if (_peerPins[i] == pin && _peerBitPeriods[i] > 0) {
+      return i;
+    }
+  }
+  return OT_PEERS;
+}
+
+// adapt decision thresholds to bit period of the peer
+void OPENTHERM::_setRxBitTicks(byte ticks) {
+  // interval longer than 3/4 of bit is long (no transition in the middle of the bit)
+  _longCapture = (1 << (ticks * 3 / 4 / 16 + 1)) - 1;
+  // no transition for 1.6 bit is encoding error
+  _maxCapture = (1 << ((ticks * 8 / 5 + 15) / 16)) - 1;
+}
+
 void OPENTHERM::_bitRead(byte value) {
   _data = (_data << 1) | value;
   _bitPos ++;
@@ -233,52 +566,45 @@ ISR(TIMER2_COMPA_vect) { // Timer2 interrupt
   OPENTHERM::_timerISR();
 }
 
-// 5 kHz timer
-void OPENTHERM::_startReadTimer() {
-  cli();
-  TCCR2A = 0; // set entire TCCR2A register to 0
-  TCCR2B = 0; // same for TCCR2B
-  TCNT2  = 0; //initialize counter value to 0
-  // set compare match register for 4kHz increments (1/4 of bit period)
-  OCR2A = 99; // = (16*10^6) / (5000*32) - 1 (must be <256)
-  TCCR2A |= (1 << WGM21); // turn on CTC mode
-  TCCR2B |= (1 << CS21) | (1 << CS20); // Set CS21 & CS20 bit for 32 prescaler
-  TIMSK2 |= (1 << OCIE2A); // enable timer compare interrupt
-  sei();
+void OPENTHERM::_initTimer() {
 }
 
-// 2 kHz timer
-void OPENTHERM::_startWriteTimer() {
-  cli();
-  TCCR2A = 0; // set entire TCCR2A register to 0
-  TCCR2B = 0; // same for TCCR2B
-  TCNT2  = 0; //initialize counter value to 0
-  // set compare match register for 2080Hz increments (2kHz to do transition in the middle of the bit)
-  OCR2A = 252;// = (16*10^6) / (2080*32) - 1 (must be <256)
-  TCCR2A |= (1 << WGM21); // turn on CTC mode
-  TCCR2B |= (1 << CS21) | (1 << CS20); // Set CS21 & CS20 bit for 32 prescaler
-  TIMSK2 |= (1 << OCIE2A); // enable timer compare interrupt
-  sei();
-}
+// Timer2 is 8-bit, pick the smallest prescaler period fits in (16ms max)
+void OPENTHERM::_startTimer(unsigned long period) {
+  static const unsigned int prescalers[] = {1, 8, 32, 64, 128, 256, 1024};
+  unsigned long ticks = period * (F_CPU / 1000000); // timer ticks at no prescaling
+  byte cs = 0;
+  while (cs < 6 && ticks / prescalers[cs] > 256) {
+    cs++;
+  }
+  ticks = constrain(ticks / prescalers[cs], 1, 256);
 
-// 1 kHz timer
-void OPENTHERM::_startTimeoutTimer() {
+  byte sreg = SREG;
   cli();
-  TCCR2A = 0; // set entire TCCR2A register to 0
-  TCCR2B = 0; // same for TCCR2B
+  TCCR2A = (1 << WGM21); // turn on CTC mode
+  TCCR2B = cs + 1; // CS22:0 bits select prescaler
   TCNT2  = 0; //initialize counter value to 0
-  // set compare match register for 1kHz increments
-  OCR2A = 249; // = (16*10^6) / (1000*64) - 1 (must be <256)
-  TCCR2A |= (1 << WGM21); // turn on CTC mode
-  TCCR2B |= (1 << CS22); // Set CS22 bit for 64 prescaler
+  OCR2A = ticks - 1; // = (16*10^6) / (frequency*prescaler) - 1 (must be <256)
+  TIFR2 = (1 << OCF2A); // clear compare match that could be pending from previous period
   TIMSK2 |= (1 << OCIE2A); // enable timer compare interrupt
-  sei();
+  SREG = sreg;
 }
 
 void OPENTHERM::_stopTimer() {
+  byte sreg = SREG;
   cli();
   TIMSK2 = 0;
-  sei();
+  SREG = sreg;
+}
+
+unsigned long OPENTHERM::_disableInterrupts() {
+  byte sreg = SREG;
+  cli();
+  return sreg;
+}
+
+void OPENTHERM::_restoreInterrupts(unsigned long state) {
+  SREG = state;
 }
 #endif // END AVR arduino Uno
 
@@ -287,52 +613,45 @@ ISR(TIMER3_COMPA_vect) { // Timer3 interrupt
   OPENTHERM::_timerISR();
 }
 
-// 5 kHz timer
-void OPENTHERM::_startReadTimer() {
-  cli();
-  TCCR3A = 0; // set entire TCCR3A register to 0
-  TCCR3B = 0; // same for TCCR3B
-  TCNT3  = 0; //initialize counter value to 0
-  // set compare match register for 4kHz increments (1/4 of bit period)
-  OCR3A = 3199; // = (16*10^6) / (5000*1) - 1 (must be <65536)
-  TCCR3B |= (1 << WGM32);  // turn on CTC mode
-  TCCR3B |= (1 << CS30);   // No prescaling
-  TIMSK3 |= (1 << OCIE3A); // enable timer compare interrupt
-  sei();
+void OPENTHERM::_initTimer() {
 }
 
-// 2 kHz timer
-void OPENTHERM::_startWriteTimer() {
-  cli();
-  TCCR3A = 0; // set entire TCCR3A register to 0
-  TCCR3B = 0; // same for TCCR3B
-  TCNT3  = 0; //initialize counter value to 0
-  // set compare match register for 2080Hz increments (2kHz to do transition in the middle of the bit)
-  OCR3A = 7691;// = (16*10^6) / (2080*1) - 1 (must be <65536)
-  TCCR3B |= (1 << WGM32); // turn on CTC mode
-  TCCR3B |= (1 << CS30);   // No prescaling
-  TIMSK3 |= (1 << OCIE3A); // enable timer compare interrupt
-  sei();
-}
+// Timer3 is 16-bit, pick the smallest prescaler period fits in (4s max)
+void OPENTHERM::_startTimer(unsigned long period) {
+  static const unsigned int prescalers[] = {1, 8, 64, 256, 1024};
+  unsigned long ticks = period * (F_CPU / 1000000); // timer ticks at no prescaling
+  byte cs = 0;
+  while (cs < 4 && ticks / prescalers[cs] > 65536) {
+    cs++;
+  }
+  ticks = constrain(ticks / prescalers[cs], 1, 65536);
 
-// 1 kHz timer
-void OPENTHERM::_startTimeoutTimer() {
+  byte sreg = SREG;
   cli();
   TCCR3A = 0; // set entire TCCR3A register to 0
-  TCCR3B = 0; // same for TCCR3B
+  TCCR3B = (1 << WGM32) | (cs + 1); // turn on CTC mode, CS32:0 bits select prescaler
   TCNT3  = 0; //initialize counter value to 0
-  // set compare match register for 1kHz increments
-  OCR3A = 15999; // = (16*10^6) / (1000*1) - 1 (must be <65536)
-  TCCR3B |= (1 << WGM32); // turn on CTC mode
-  TCCR3B |= (1 << CS30);   // No prescaling
+  OCR3A = ticks - 1; // = (16*10^6) / (frequency*prescaler) - 1 (must be <65536)
+  TIFR3 = (1 << OCF3A); // clear compare match that could be pending from previous period
   TIMSK3 |= (1 << OCIE3A); // enable timer compare interrupt
-  sei();
+  SREG = sreg;
 }
 
 void OPENTHERM::_stopTimer() {
+  byte sreg = SREG;
   cli();
   TIMSK3 = 0;
-  sei();
+  SREG = sreg;
+}
+
+unsigned long OPENTHERM::_disableInterrupts() {
+  byte sreg = SREG;
+  cli();
+  return sreg;
+}
+
+void OPENTHERM::_restoreInterrupts(unsigned long state) {
+  SREG = state;
 }
 #endif // END AVR arduino Leonardo
 
@@ -343,76 +662,74 @@ ISR(TCB0_INT_vect) {
   TCB0.INTFLAGS = TCB_CAPT_bm; // clear interrupt flag
 }
 
-// 5 kHz timer
-void OPENTHERM::_startReadTimer() {
-  cli();
-  TCB0.CTRLB = TCB_CNTMODE_INT_gc; // use timer compare mode
-  TCB0.CCMP = 3199; // value to compare with (16*10^6) / 5000 - 1
-  TCB0.INTCTRL = TCB_CAPT_bm; // enable the interrupt
-  TCB0.CTRLA = TCB_CLKSEL_CLKDIV1_gc | TCB_ENABLE_bm; // use Timer A as clock, enable timer
-  sei();
+void OPENTHERM::_initTimer() {
 }
 
-// 2 kHz timer
-void OPENTHERM::_startWriteTimer() {
-  cli();
-  TCB0.CTRLB = TCB_CNTMODE_INT_gc; // use timer compare mode
-  TCB0.CCMP = 7999; // value to compare with (16*10^6) / 2000 - 1
-  TCB0.INTCTRL = TCB_CAPT_bm; // enable the interrupt
-  TCB0.CTRLA = TCB_CLKSEL_CLKDIV1_gc | TCB_ENABLE_bm; // use Timer A as clock, enable timer
-  sei();
-}
+// TCB0 is 16-bit and can only halve the clock (8ms max)
+void OPENTHERM::_startTimer(unsigned long period) {
+  unsigned long ticks = period * (F_CPU / 1000000); // timer ticks at no prescaling
+  byte clksel = TCB_CLKSEL_CLKDIV1_gc;
+  if (ticks > 65536) {
+    ticks /= 2;
+    clksel = TCB_CLKSEL_CLKDIV2_gc;
+  }
+  ticks = constrain(ticks, 1, 65536);
 
-// 1 kHz timer
-void OPENTHERM::_startTimeoutTimer() {
+  byte sreg = SREG;
   cli();
+  TCB0.CTRLA = 0; // disable timer while it is reconfigured
   TCB0.CTRLB = TCB_CNTMODE_INT_gc; // use timer compare mode
-  TCB0.CCMP = 15999; // value to compare with (16*10^6) / 1000 - 1
+  TCB0.CNT = 0;
+  TCB0.CCMP = ticks - 1; // value to compare with (16*10^6) / frequency - 1
+  TCB0.INTFLAGS = TCB_CAPT_bm; // clear interrupt that could be pending from previous period
   TCB0.INTCTRL = TCB_CAPT_bm; // enable the interrupt
-  TCB0.CTRLA = TCB_CLKSEL_CLKDIV1_gc | TCB_ENABLE_bm; // use Timer A as clock, enable timer
-  sei();
+  TCB0.CTRLA = clksel | TCB_ENABLE_bm; // enable timer
+  SREG = sreg;
 }
 
 void OPENTHERM::_stopTimer() {
+  byte sreg = SREG;
   cli();
   TCB0.CTRLA = 0;
-  sei();
+  SREG = sreg;
 }
-#endif // END ATMega4809 Arduino Uno Wifi Rev2, Arduino Nano Every
 
-#ifdef ESP8266
-// 5 kHz timer
-void OPENTHERM::_startReadTimer() {
-  noInterrupts();
-  timer1_attachInterrupt(OPENTHERM::_timerISR);
-  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP); // 5MHz (5 ticks/us - 1677721.4 us max)
-  timer1_write(1000); // 5kHz
-  interrupts();
+unsigned long OPENTHERM::_disableInterrupts() {
+  byte sreg = SREG;
+  cli();
+  return sreg;
+}
+
+void OPENTHERM::_restoreInterrupts(unsigned long state) {
+  SREG = state;
 }
+#endif // END ATMega4809 Arduino Uno Wifi Rev2, Arduino Nano Every
 
-// 2 kHz timer
-void OPENTHERM::_startWriteTimer() {
-  noInterrupts();
-  timer1_attachInterrupt(OPENTHERM::_timerISR);
-  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP); // 5MHz (5 ticks/us - 1677721.4 us max)
-  timer1_write(2500); // 2kHz
-  interrupts();
+#ifdef ESP8266
+void OPENTHERM::_initTimer() {
+  static bool attached = false;
+  if (!attached) {
+    timer1_attachInterrupt(OPENTHERM::_timerISR);
+    attached = true;
+  }
 }
 
-// 1 kHz timer
-void OPENTHERM::_startTimeoutTimer() {
-  noInterrupts();
-  timer1_attachInterrupt(OPENTHERM::_timerISR);
-  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP); // 5MHz (5 ticks/us - 1677721.4 us max)
-  timer1_write(5000); // 1kHz
-  interrupts();
+// 5MHz (5 ticks/us - 1677721.4 us max)
+void OPENTHERM::_startTimer(unsigned long period) {
+  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+  timer1_write(min(period, 1677721UL) * 5);
 }
 
 void OPENTHERM::_stopTimer() {
-  noInterrupts();
   timer1_disable();
-  timer1_detachInterrupt();
-  interrupts();
+}
+
+unsigned long OPENTHERM::_disableInterrupts() {
+  return xt_rsil(15); // returns previous interrupt level
+}
+
+void OPENTHERM::_restoreInterrupts(unsigned long state) {
+  xt_wsr_ps(state);
 }
 #endif // END ESP8266
 
@@ -420,48 +737,38 @@ void OPENTHERM::_stopTimer() {
 
 static hw_timer_t * timer = NULL;
 
-static void initTimer() {
+void OPENTHERM::_initTimer() {
   if (timer == NULL) {
-    timer = timerBegin(0, 80, true);
+    timer = timerBegin(0, 80, true); // 1MHz (1 tick/us)
+    timerAttachInterrupt(timer, OPENTHERM::_timerISR, true);
   }
 }
 
-// 5 kHz timer
-void OPENTHERM::_startReadTimer() {
-  noInterrupts();
-  initTimer();
-  timerAttachInterrupt(timer, OPENTHERM::_timerISR, true);
-  timerAlarmWrite(timer, 200, true);
+void OPENTHERM::_startTimer(unsigned long period) {
+  timerWrite(timer, 0);
+  timerAlarmWrite(timer, period, true);
   timerAlarmEnable(timer);
-  interrupts();
 }
 
-// 2 kHz timer
-void OPENTHERM::_startWriteTimer() {
-  noInterrupts();
-  initTimer();
-  timerAttachInterrupt(timer, OPENTHERM::_timerISR, true);
-  timerAlarmWrite(timer, 500, true);
-  timerAlarmEnable(timer);
-  interrupts();
+void OPENTHERM::_stopTimer() {
+  timerAlarmDisable(timer);
 }
 
-// 1 kHz timer
-void OPENTHERM::_startTimeoutTimer() {
-  noInterrupts();
-  initTimer();
-  timerAttachInterrupt(timer, OPENTHERM::_timerISR, true);
-  timerAlarmWrite(timer, 1000, true);
-  timerAlarmEnable(timer);
-  interrupts();
+#ifndef portENTER_CRITICAL_SAFE // older cores, where plain critical section works from interrupt too
+#define portENTER_CRITICAL_SAFE portENTER_CRITICAL
+#define portEXIT_CRITICAL_SAFE portEXIT_CRITICAL
+#endif
+
+static portMUX_TYPE timerMux = portMUX_INITIALIZER_UNLOCKED;
+
+// critical section nests, so there is no state to restore
+unsigned long OPENTHERM::_disableInterrupts() {
+  portENTER_CRITICAL_SAFE(&timerMux);
+  return 0;
 }
 
-void OPENTHERM::_stopTimer() {
-  noInterrupts();
-  initTimer();
-  timerAlarmDisable(timer);
-  timerDetachInterrupt(timer);
-  interrupts();
+void OPENTHERM::_restoreInterrupts(unsigned long) {
+  portEXIT_CRITICAL_SAFE(&timerMux);
 }
 #endif  // END ESP32
 
@@ -545,3 +852,303 @@ void OpenthermData::s16(int16_t value) {
   valueLB = value & 0xFF;
   valueHB = (value >> 8) & 0xFF;
 }
+
+#define CAPABILITIES_MAGIC_1 'O'
+#define CAPABILITIES_MAGIC_2 'T'
+
+OpenthermCapabilities::OpenthermCapabilities() {
+  clear();
+  _changed = false;
+}
+
+void OpenthermCapabilities::clear() {
+  _fingerprintMask = 0;
+  for (byte i = 0; i < 3; i++) {
+    _fingerprint[i] = 0;
+  }
+  for (byte i = 0; i < 32; i++) {
+    _known[i] = 0;
+    _supported[i] = 0;
+    _readable[i] = 0;
+    _writable[i] = 0;
+    _verified[i] = 0;
+  }
+  _changed = true;
+}
+
+bool OpenthermCapabilities::load(int address, byte (*read)(int address)) {
+  byte checksum = 0;
+  for (int i = 0; i < OT_CAPABILITIES_SIZE - 1; i++) {
+    checksum ^= read(address + i);
+  }
+  if (read(address) != CAPABILITIES_MAGIC_1 || read(address + 1) != CAPABILITIES_MAGIC_2
+      || read(address + OT_CAPABILITIES_SIZE - 1) != checksum) {
+    clear();
+    _changed = false;
+    return false;
+  }
+
+  int pos = address + 2;
+  _fingerprintMask = read(pos++);
+  for (byte i = 0; i < 3; i++) {
+    _fingerprint[i] = read(pos++) << 8;
+    _fingerprint[i] |= read(pos++);
+  }
+  for (byte i = 0; i < 32; i++) {
+    _known[i] = read(pos++);
+    _supported[i] = read(pos++);
+    _readable[i] = read(pos++);
+    _writable[i] = read(pos++);
+    _verified[i] = 0;
+  }
+  _changed = false;
+  return true;
+}
+
+static void writeByte(void (*write)(int address, byte value), int address, byte value, byte &checksum) {
+  write(address, value);
+  checksum ^= value;
+}
+
+bool OpenthermCapabilities::save(int address, void (*write)(int address, byte value)) {
+  if (!_changed) {
+    return false;
+  }
+
+  byte checksum = 0;
+  int pos = address;
+  writeByte(write, pos++, CAPABILITIES_MAGIC_1, checksum);
+  writeByte(write, pos++, CAPABILITIES_MAGIC_2, checksum);
+  writeByte(write, pos++, _fingerprintMask, checksum);
+  for (byte i = 0; i < 3; i++) {
+    writeByte(write, pos++, _fingerprint[i] >> 8, checksum);
+    writeByte(write, pos++, _fingerprint[i] & 0xFF, checksum);
+  }
+  for (byte i = 0; i < 32; i++) {
+    writeByte(write, pos++, _known[i], checksum);
+    writeByte(write, pos++, _supported[i], checksum);
+    writeByte(write, pos++, _readable[i], checksum);
+    writeByte(write, pos++, _writable[i], checksum);
+  }
+  write(pos, checksum);
+  _changed = false;
+  return true;
+}
+
+void OpenthermCapabilities::update(OpenthermData &data) {
+  byte id = data.id;
+  bool supported = true;
+  bool readable = bitRead(_readable[id >> 3], id & 7);
+  bool writable = bitRead(_writable[id >> 3], id & 7);
+
+  if (data.type == OT_MSGTYPE_READ_ACK) {
+    readable = true;
+    if (id == OT_MSGID_SLAVE_CONFIG) {
+      _checkFingerprint(0, data.u16());
+    }
+    else if (id == OT_MSGID_OT_VERSION_SLAVE) {
+      _checkFingerprint(1, data.u16());
+    }
+    else if (id == OT_MSGID_VERSION_SLAVE) {
+      _checkFingerprint(2, data.u16());
+    }
+  }
+  else if (data.type == OT_MSGTYPE_WRITE_ACK) {
+    writable = true;
+  }
+  else if (data.type == OT_MSGTYPE_UNKNOWN_DATAID) {
+    supported = readable = writable = false;
+  }
+  else if (data.type == OT_MSGTYPE_DATA_INVALID) {
+    // data ID is recognized but its value is not available now (e.g. sensor fault), that is usually transient
+    // and tells nothing about whether it can be read or written, so data ID is not learned and will be probed again
+    if (isKnown(id)) {
+      _setFlag(_supported, id, true);
+    }
+    bitSet(_verified[id >> 3], id & 7);
+    return;
+  }
+  else {
+    return; // not a slave response
+  }
+
+  _setFlag(_known, id, true);
+  _setFlag(_supported, id, supported);
+  _setFlag(_readable, id, readable);
+  _setFlag(_writable, id, writable);
+  bitSet(_verified[id >> 3], id & 7);
+}
+
+void OpenthermCapabilities::_checkFingerprint(byte index, uint16_t value) {
+  if (bitRead(_fingerprintMask, index) && _fingerprint[index] != value) {
+    clear(); // different slave, restored map is not valid anymore
+  }
+  if (!bitRead(_fingerprintMask, index) || _fingerprint[index] != value) {
+    bitSet(_fingerprintMask, index);
+    _fingerprint[index] = value;
+    _changed = true;
+  }
+}
+
+void OpenthermCapabilities::_setFlag(byte *flags, byte id, bool value) {
+  if (bitRead(flags[id >> 3], id & 7) != value) {
+    bitWrite(flags[id >> 3], id & 7, value);
+    _changed = true;
+  }
+}
+
+bool OpenthermCapabilities::isKnown(byte id) {
+  return bitRead(_known[id >> 3], id & 7);
+}
+
+bool OpenthermCapabilities::isSupported(byte id) {
+  return !isKnown(id) || bitRead(_supported[id >> 3], id & 7);
+}
+
+bool OpenthermCapabilities::isReadable(byte id) {
+  return bitRead(_readable[id >> 3], id & 7);
+}
+
+bool OpenthermCapabilities::isWritable(byte id) {
+  return bitRead(_writable[id >> 3], id & 7);
+}
+
+bool OpenthermCapabilities::isVerified(byte id) {
+  return bitRead(_verified[id >> 3], id & 7);
+}
+
+bool OpenthermCapabilities::isChanged() {
+  return _changed;
+}
+
+#define WRITE_PENDING 1  // value waits to be sent
+#define WRITE_ACKED 2    // ackValue is valid
+#define WRITE_REJECTED 4 // value was rejected by slave
+#define WRITE_SENT 8     // sent and not answered yet
+#define WRITE_BACKOFF_MAX 4 // retry interval doubles at most this many times
+#define NO_WRITE 0xFF    // no write in flight
+
+OpenthermWriteQueue::OpenthermWriteQueue() {
+  _count = 0;
+  _nextIndex = 0;
+  _sentIndex = NO_WRITE;
+}
+
+bool OpenthermWriteQueue::configure(byte id, float deadband, unsigned long refreshInterval) {
+  Entry *entry = _find(id, true);
+  if (entry == NULL) {
+    return false;
+  }
+  entry->deadband = deadband * 256;
+  entry->refreshInterval = refreshInterval;
+  return true;
+}
+
+bool OpenthermWriteQueue::write(OpenthermData &data) {
+  Entry *entry = _find(data.id, true);
+  if (entry == NULL) {
+    return false;
+  }
+  uint16_t value = data.u16();
+  if ((entry->flags & WRITE_REJECTED) && entry->value == value) {
+    return true; // slave would reject it again
+  }
+  entry->value = value;
+  entry->flags = (entry->flags & ~WRITE_REJECTED) | WRITE_PENDING;
+  return true;
+}
+
+bool OpenthermWriteQueue::next(OpenthermData &data) {
+  _sentIndex = NO_WRITE;
+  for (byte i = 0; i < _count; i++) {
+    byte index = _nextIndex;
+    Entry &entry = _entries[index];
+    _nextIndex = (_nextIndex + 1) % _count; // round robin so single busy data ID can't starve others
+    if (_isDue(entry)) {
+      _sentIndex = index;
+      if ((entry.flags & WRITE_SENT) && entry.retries < 255) {
+        entry.retries++; // previous one was not answered
+      }
+      entry.flags |= WRITE_SENT;
+      entry.sentTime = millis();
+      entry.sentValue = entry.value;
+      data.type = OT_MSGTYPE_WRITE_DATA;
+      data.id = entry.id;
+      data.u16(entry.value);
+      return true;
+    }
+  }
+  return false;
+}
+
+void OpenthermWriteQueue::acknowledge(OpenthermData &data) {
+  if (_sentIndex == NO_WRITE || _entries[_sentIndex].id != data.id) {
+    return; // not a response to write in flight
+  }
+  if (data.type != OT_MSGTYPE_WRITE_ACK && data.type != OT_MSGTYPE_DATA_INVALID && data.type != OT_MSGTYPE_UNKNOWN_DATAID) {
+    return;
+  }
+  Entry *entry = &_entries[_sentIndex];
+  _sentIndex = NO_WRITE;
+  entry->flags &= ~WRITE_SENT;
+  entry->retries = 0;
+
+  if (data.type == OT_MSGTYPE_WRITE_ACK) {
+    entry->ackValue = entry->sentValue; // slave may echo adjusted value, compare with what was asked for
+    entry->ackTime = millis();
+    entry->flags |= WRITE_ACKED;
+    if (entry->value == entry->sentValue) {
+      entry->flags &= ~WRITE_PENDING;
+    }
+  }
+  else if (entry->value == entry->sentValue) { // DataInvalid or UnknownId
+    entry->flags = (entry->flags & ~WRITE_PENDING) | WRITE_REJECTED; // do not retry until different value is written
+  }
+}
+
+OpenthermWriteQueue::Entry *OpenthermWriteQueue::_find(byte id, bool create) {
+  for (byte i = 0; i < _count; i++) {
+    if (_entries[i].id == id) {
+      return &_entries[i];
+    }
+  }
+  if (!create || _count >= OT_WRITE_QUEUE_SIZE) {
+    return NULL;
+  }
+  Entry *entry = &_entries[_count++];
+  entry->id = id;
+  entry->flags = 0;
+  entry->value = 0;
+  entry->sentValue = 0;
+  entry->ackValue = 0;
+  entry->deadband = 0;
+  entry->refreshInterval = OT_WRITE_REFRESH_INTERVAL;
+  entry->ackTime = 0;
+  entry->sentTime = 0;
+  entry->retries = 0;
+  return entry;
+}
+
+bool OpenthermWriteQueue::_isDue(Entry &entry) {
+  if (entry.flags & WRITE_REJECTED) {
+    return false; // neither pending nor keep-alive of value slave rejected
+  }
+  if ((entry.flags & WRITE_SENT)
+      && millis() - entry.sentTime < (unsigned long) OT_WRITE_RETRY_INTERVAL << min(entry.retries, (byte) WRITE_BACKOFF_MAX)) {
+    return false; // last write was not answered, give slave a break
+  }
+  if (!(entry.flags & WRITE_ACKED)) {
+    return entry.flags & WRITE_PENDING; // nothing acknowledged yet, send whatever is pending
+  }
+  if (entry.refreshInterval > 0 && millis() - entry.ackTime >= entry.refreshInterval) {
+    return true; // keep-alive
+  }
+  if (entry.flags & WRITE_PENDING) {
+    long diff = (long)(int16_t) entry.value - (int16_t) entry.ackValue;
+    if (abs(diff) > entry.deadband) {
+      return true;
+    }
+    entry.flags &= ~WRITE_PENDING; // within deadband, suppressed
+  }
+  return false;
+}
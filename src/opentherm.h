@@ -122,6 +122,9 @@ struct OpenthermData {
   void s16(int16_t value);
 };
 
+#define OT_PEERS 2 // number of lines (input pins) to remember measured bit period of peer for
+#define OT_DEADLINES 2 // number of user deadlines that can be scheduled at the same time
+
 /**
  * Opentherm static class that supports either listening or sending Opentherm data packets in the same time
  */
@@ -175,13 +178,13 @@ class OPENTHERM {
 
     /**
      * Stops listening for data packet or sending out data packet and resets internal state of this class.
-     * Stops all timers and unattaches all interrupts.
+     * Unattaches all interrupts and stops timer unless there is a deadline scheduled by setDeadline().
      */
     static void stop();
 
     /**
      * Indicates whether listinig or sending is not in progress.
-     * That also means that no timers are running and no interrupts are attached.
+     * That also means that no interrupts are attached and timer runs only for deadlines scheduled by setDeadline().
      * 
      * @return true if listening nor sending is in progress.
      */
@@ -194,6 +197,75 @@ class OPENTHERM {
      */
     static bool isError();
 
+    /**
+     * Set minimal time between end of last data packet sent or received and start of next data packet sent by send().
+     * If send() is called sooner, sending is postponed and isSent() turns true once data packet is sent.
+     * Opentherm requires 100ms spacing between response and next request of master and 20ms between request and response of slave.
+     * 
+     * @param spacing minimal time in millis, 0 (default) to send immediately.
+     */
+    static void setFrameSpacing(unsigned int spacing);
+
+    /**
+     * Schedule callback to be called after given time. Uses the same hardware timer as Opentherm communication,
+     * so no other timer is needed for time-critical tasks. Up to OT_DEADLINES callbacks can be scheduled at the same time.
+     * Callback is called from interrupt, so keep it short. It can call setDeadline() to schedule itself again.
+     * On AVR it can also call send(), listen() and stop(), e.g. to send request exactly on time. ESP8266 and ESP32 can't attach
+     * pin interrupt from interrupt, so there set a flag in callback and call them from loop().
+     * Scheduling the same callback again reschedules it.
+     * Callback that is due while data packet is being read or written is called once it is over (up to one frame, about 34ms, late),
+     * so it never shifts bit timing. While listening on pin without interrupt, long callback can still delay start of frame detection.
+     * 
+     * @param delay time in millis after which callback is called.
+     * @param callback function to call.
+     * @return true if callback was scheduled, false if all OT_DEADLINES are already in use.
+     */
+    static bool setDeadline(unsigned long delay, void (*callback)());
+
+    /**
+     * Cancel callback scheduled by setDeadline().
+     * 
+     * @param callback function to cancel.
+     */
+    static void cancelDeadline(void (*callback)());
+
+    /**
+     * Set bit period used to send data packets. Default is nominal Opentherm bit period of 1000us (1kbit/s).
+     * Opentherm devices are required to accept bit periods between 900us and 1150us.
+     * 
+     * @param period bit period in micros, clamped to 800-1500us. Pass 0 to match bit period measured from data packets
+     * received from peer (see linkPins()), matched bit period is kept within 900-1150us.
+     */
+    static void setBitPeriod(unsigned int period);
+
+    /**
+     * Tell that given input and output pins are connected to the same peer, so data packets sent on output pin match
+     * bit period measured on input pin when setBitPeriod(0) is used. Gateway needs to link both its lines, otherwise
+     * bit period is matched only while it has been measured on single line. Up to OT_PEERS links are kept.
+     * 
+     * @param inputPin pin passed to listen() to receive data packets from peer.
+     * @param outputPin pin passed to send() to send data packets to the same peer.
+     */
+    static void linkPins(byte inputPin, byte outputPin);
+
+    /**
+     * @param pin output pin
+     * @return bit period in micros used to send data packets on given pin.
+     */
+    static unsigned int getBitPeriod(byte pin);
+
+    /**
+     * Bit period of the peer measured over full data packets received on given pin and averaged over several of them.
+     * Receiver adapts its decision thresholds to it (separately for up to OT_PEERS pins), so peers with out of tolerance
+     * clocks are decoded reliably. Single data packet is measured with resolution of 6us (200us sampling spread over 33.5 bits).
+     * Thresholds are whole numbers of samples, so they change only at few bit periods (about 1013us, 1075us and 1138us
+     * within 900-1150us).
+     * 
+     * @param pin input pin
+     * @return measured bit period in micros, nominal 1000us until first data packet is received on the pin.
+     */
+    static unsigned int getPeerBitPeriod(byte pin);
+
     /**
      * Helper function to debug content of data packet.
      * It will print whatevet is in given data packet to Serial as formatted string.
@@ -202,14 +274,35 @@ class OPENTHERM {
      */
     static void printToSerial(OpenthermData &data);
 
+    /**
+     * Encode data packet into 32-bit Opentherm frame as it is transmitted on the line, including parity bit.
+     * Useful for emulators and simulations that exchange frames without physical line.
+     * 
+     * @param data data packet to encode
+     * @return 32-bit Opentherm frame
+     */
+    static unsigned long encode(OpenthermData &data);
+
+    /**
+     * Decode 32-bit Opentherm frame into data packet. Frame is decoded only if its parity is valid.
+     * 
+     * @param frame 32-bit Opentherm frame as received from the line
+     * @param data reference to data structure to which fill the data packet data.
+     * @return true if frame has valid parity and was decoded into data structure passed, false otherwise.
+     */
+    static bool decode(unsigned long frame, OpenthermData &data);
+
 #ifdef AVR
     static void _timerISR(); // this function needs to be public since its attached as interrupt handler
+    static void _edgeISR();
 #endif // END ESP8266
 #ifdef ESP8266
     static void ICACHE_RAM_ATTR _timerISR(); // this function needs to be public since its attached as interrupt handler
+    static void ICACHE_RAM_ATTR _edgeISR();
 #endif // END ESP8266
 #ifdef ESP32
     static void IRAM_ATTR _timerISR(); // this function needs to be public since its attached as interrupt handler
+    static void IRAM_ATTR _edgeISR();
 #endif // END ESP32
 
   private:
@@ -224,16 +317,49 @@ class OPENTHERM {
     static volatile unsigned long _data;
     static volatile byte _bitPos;
     static volatile bool _active;
-    static volatile int _timeoutCounter; // <0 no timeout
+    static volatile bool _bitClock; // timer runs at bit clock rate (reading, writing or polling the pin)
+    static volatile bool _timeout;
+    static volatile unsigned long _timeoutDeadline;
+    static volatile unsigned long _lastFrameTime; // end of last frame sent or received
+    static unsigned int _frameSpacing;
+    static unsigned int _halfBitPeriod;
+    static volatile unsigned long _timerPeriod; // period timer is programmed to, 0 if stopped
+    static bool _edgeAttached; // start of frame is detected by pin interrupt
+    static void (* volatile _deadlineCallbacks[OT_DEADLINES])();
+    static volatile unsigned long _deadlines[OT_DEADLINES];
+    static volatile unsigned int _frameTicks; // read timer ticks since start of frame
+    static volatile unsigned int _lastTransition; // read timer ticks from start of frame to last signal transition
+    static volatile byte _transitions; // signal transitions since start of frame
+    static volatile bool _fullFrame; // frame started on idle line, so it can be measured
+    static volatile bool _lineIdle; // line is known to be idle since listening started
+    static volatile unsigned long _listenTime; // micros when listening started
+    static volatile unsigned int _longCapture; // capture above which signal did not change for whole bit
+    static volatile unsigned int _maxCapture; // capture above which signal did not change for too long
+    static unsigned int _txBitPeriod; // 0 to match peer
+    static byte _peerPins[OT_PEERS]; // pins with measured bit period of peer
+    static unsigned int _peerBitPeriods[OT_PEERS]; // in micros, 0 if not measured
+    static byte _peerNext; // slot to replace when bit period is measured on new line
+    static byte _linkInputPins[OT_PEERS]; // input pin of peer each output pin sends to
+    static byte _linkOutputPins[OT_PEERS];
+    static byte _linkCount;
 
     static void _listen(); // listen to incoming data packets
     static void _read(); // data detected start reading
-    static void _stop(); // stop timers and interrupts
-    static void _startReadTimer(); // reading timer to sample at 1/5 of manchester code bit length (at 5kHz)
-    static void _startWriteTimer(); // writing timer to send manchester code (at 2kHz)
-    static void _startTimeoutTimer(); // timeout count down timer (at 1kHz)
+    static void _stop(); // stop bit clock, timer keeps running only for pending deadlines
+    static void _detachEdge();
+    static void _bitTick(); // bit clock: sample pin at 1/5 of manchester code bit length (at 5kHz) or write half of the bit
+    static void _checkDeadlines();
+    static void _schedule(); // program timer for next due event
+    static void _initTimer();
+    static void _startTimer(unsigned long period); // period in micros
     static void _stopTimer();
+    static unsigned long _disableInterrupts(); // returns state for _restoreInterrupts(), safe to use inside interrupt
+    static void _restoreInterrupts(unsigned long state);
     static bool _checkParity(unsigned long val);
+    static void _skip();
+    static void _calibrate();
+    static byte _findPeer(byte pin);
+    static void _setRxBitTicks(byte ticks);
 
     static void _bitRead(byte value);
     static bool _verifyStopBit(byte value);
@@ -241,4 +367,171 @@ class OPENTHERM {
     static void _callCallback();
 };
 
+#define OT_CAPABILITIES_SIZE 138 // bytes of persistent storage taken by OpenthermCapabilities
+
+/**
+ * Map of data IDs supported by slave (boiler), learned from responses and persisted (typically in EEPROM) for fast warm start.
+ * Once restored by load() master can skip data IDs known to be unsupported instead of probing them again after every reboot.
+ * Map is keyed by slave fingerprint made of slave config (OT_MSGID_SLAVE_CONFIG), Opentherm version (OT_MSGID_OT_VERSION_SLAVE)
+ * and product version (OT_MSGID_VERSION_SLAVE). Fingerprint is checked lazily as these responses arrive and whole map is cleared
+ * if it does not match the restored one.
+ * Storage is accessed through callbacks passed to load() and save(), so library itself does not depend on EEPROM library.
+ */
+class OpenthermCapabilities {
+  public:
+    OpenthermCapabilities();
+
+    /**
+     * Restore map from persistent storage. Restored data IDs are not verified until slave responds to them again.
+     * 
+     * @param address address where map is stored, map takes OT_CAPABILITIES_SIZE bytes from there.
+     * @param read callback that reads single byte from given address, e.g. wrapper of EEPROM.read().
+     * @return true if valid map was found, false otherwise (map is empty then).
+     */
+    bool load(int address, byte (*read)(int address));
+
+    /**
+     * Store map to persistent storage if it has changed since last load() or save().
+     * Write callback should skip bytes that did not change to spare EEPROM (as EEPROM.update() does on AVR).
+     * On ESP8266 and ESP32 call EEPROM.commit() once save() returns true.
+     * 
+     * @param address address where to store map, map takes OT_CAPABILITIES_SIZE bytes from there.
+     * @param write callback that writes single byte to given address, e.g. wrapper of EEPROM.update().
+     * @return true if map was written, false if there was nothing to write.
+     */
+    bool save(int address, void (*write)(int address, byte value));
+
+    /**
+     * Forget all learned data IDs and slave fingerprint.
+     */
+    void clear();
+
+    /**
+     * Learn from slave response. Pass every response received from slave, requests and other messages are ignored.
+     * 
+     * @param data data packet received from slave
+     */
+    void update(OpenthermData &data);
+
+    /**
+     * @return true if slave already acknowledged given data ID or reported it unknown (or it has been restored from EEPROM).
+     * DataInvalid response does not make data ID known, as it is usually transient.
+     */
+    bool isKnown(byte id);
+
+    /**
+     * @return true if data ID is known and slave supports it. Data IDs not known yet are reported as supported so they are probed.
+     */
+    bool isSupported(byte id);
+
+    /**
+     * @return true if slave acknowledged read of given data ID.
+     */
+    bool isReadable(byte id);
+
+    /**
+     * @return true if slave acknowledged write of given data ID.
+     */
+    bool isWritable(byte id);
+
+    /**
+     * @return true if slave responded to given data ID since boot, false if the data ID is only restored from EEPROM.
+     */
+    bool isVerified(byte id);
+
+    /**
+     * @return true if map has changed and should be saved.
+     */
+    bool isChanged();
+
+  private:
+    uint16_t _fingerprint[3]; // slave config, Opentherm version, product version
+    byte _fingerprintMask; // which parts of fingerprint are known
+    byte _known[32];
+    byte _supported[32];
+    byte _readable[32];
+    byte _writable[32];
+    byte _verified[32]; // not persisted
+    bool _changed;
+
+    void _checkFingerprint(byte index, uint16_t value);
+    void _setFlag(byte *flags, byte id, bool value);
+};
+
+#define OT_WRITE_QUEUE_SIZE 8 // number of data IDs write queue can hold
+#define OT_WRITE_REFRESH_INTERVAL 10000 // default keep-alive interval in millis
+#define OT_WRITE_RETRY_INTERVAL 1000 // min delay before unanswered write is sent again, doubles with each retry up to 16x
+
+/**
+ * Queue of WRITE_DATA requests for master that saves bus capacity.
+ * Pending writes to the same data ID are merged so only the latest value is sent, writes within deadband of the last
+ * acknowledged value are suppressed, and the latest value is still re-sent after refresh interval as a keep-alive.
+ * Value rejected by slave is not sent again until a different value is written.
+ */
+class OpenthermWriteQueue {
+  public:
+    OpenthermWriteQueue();
+
+    /**
+     * Configure write suppression of given data ID. Data IDs that are written without being configured use no deadband
+     * and default refresh interval.
+     * 
+     * @param id data ID to configure
+     * @param deadband writes that differ from last acknowledged value by this or less are not sent (in units of f8.8 value)
+     * @param refreshInterval max time in millis between two writes of the same data ID. Pass 0 to disable keep-alive.
+     * @return true if configured, false if queue is full
+     */
+    bool configure(byte id, float deadband, unsigned long refreshInterval = OT_WRITE_REFRESH_INTERVAL);
+
+    /**
+     * Queue write of data packet value. Replaces value of pending write to the same data ID if there is any.
+     * Writing the same value slave rejected last time does nothing.
+     * 
+     * @param data data packet with data ID and value to write, type is ignored
+     * @return true if queued, false if queue is full
+     */
+    bool write(OpenthermData &data);
+
+    /**
+     * Get next write that should be sent to slave. Write stays in queue until it is acknowledged.
+     * Returned write is in flight until acknowledge() or the next call of this function.
+     * 
+     * @param data reference to data structure to which fill the WRITE_DATA packet.
+     * @return true if there is write to be sent, false otherwise (bus slot can be used for reads).
+     */
+    bool next(OpenthermData &data);
+
+    /**
+     * Pass slave response to write returned by next(). WriteAck completes the write, DataInvalid or UnknownId rejects its value.
+     * Responses to anything but write in flight (e.g. read of the same data ID) are ignored, so it is safe to pass all of them.
+     * If there is no response at all (timeout) simply do not call this function and the write will be retried after
+     * OT_WRITE_RETRY_INTERVAL, backing off while slave keeps ignoring it so that reads still get bus slots.
+     * 
+     * @param data data packet received from slave
+     */
+    void acknowledge(OpenthermData &data);
+
+  private:
+    struct Entry {
+      byte id;
+      byte flags;
+      uint16_t value; // latest value requested
+      uint16_t sentValue; // value returned by last next()
+      uint16_t ackValue; // last value acknowledged by slave
+      uint16_t deadband;
+      unsigned long refreshInterval;
+      unsigned long ackTime;
+      unsigned long sentTime; // last time returned by next()
+      byte retries; // writes sent without response
+    };
+
+    Entry _entries[OT_WRITE_QUEUE_SIZE];
+    byte _count;
+    byte _nextIndex;
+    byte _sentIndex; // write in flight
+
+    Entry *_find(byte id, bool create);
+    bool _isDue(Entry &entry);
+};
+
 #endif
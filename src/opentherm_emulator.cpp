@@ -0,0 +1,389 @@
+#include "opentherm_emulator.h"
+
+#define REG_READ 1   // register can be read by master
+#define REG_WRITE 2  // register can be written by master
+
+struct BoilerRegister {
+  byte id;
+  byte access;
+  uint16_t value; // value after power up
+};
+
+// register model of emulated boiler, data IDs not listed here are responded with UnknownId
+static const BoilerRegister boilerRegisters[OT_BOILER_REGISTERS] = {
+  {OT_MSGID_STATUS, REG_READ, 0},
+  {OT_MSGID_CH_SETPOINT, REG_WRITE, 0},
+  {OT_MSGID_MASTER_CONFIG, REG_WRITE, 0},
+  {OT_MSGID_SLAVE_CONFIG, REG_READ, 0x0300}, // DHW present, modulating
+  {OT_MSGID_FAULT_FLAGS, REG_READ, 0},
+  {OT_MSGID_MAX_MODULATION_LEVEL, REG_WRITE, 0x6400}, // 100%
+  {OT_MSGID_ROOM_SETPOINT, REG_WRITE, 0},
+  {OT_MSGID_MODULATION_LEVEL, REG_READ, 0},
+  {OT_MSGID_CH_WATER_PRESSURE, REG_READ, 0x0180}, // 1.5 bar
+  {OT_MSGID_ROOM_TEMP, REG_WRITE, 0},
+  {OT_MSGID_FEED_TEMP, REG_READ, 0x1400}, // 20 C
+  {OT_MSGID_DHW_TEMP, REG_READ, 0x2D00}, // 45 C
+  {OT_MSGID_OUTSIDE_TEMP, REG_READ | REG_WRITE, 0x0500}, // 5 C
+  {OT_MSGID_RETURN_WATER_TEMP, REG_READ, 0x1400}, // 20 C
+  {OT_MSGID_DHW_BOUNDS, REG_READ, 0x3C23}, // 35-60 C
+  {OT_MSGID_CH_BOUNDS, REG_READ, 0x5014}, // 20-80 C
+  {OT_MSGID_DHW_SETPOINT, REG_READ | REG_WRITE, 0x2D00}, // 45 C
+  {OT_MSGID_MAX_CH_SETPOINT, REG_READ | REG_WRITE, 0x5000}, // 80 C
+  {OT_MSGID_BURNER_STARTS, REG_READ | REG_WRITE, 0},
+  {OT_MSGID_BURNER_HOURS, REG_READ | REG_WRITE, 0},
+  {OT_MSGID_OT_VERSION_MASTER, REG_WRITE, 0},
+  {OT_MSGID_OT_VERSION_SLAVE, REG_READ, 0x0216}, // 2.2
+  {OT_MSGID_VERSION_MASTER, REG_WRITE, 0},
+  {OT_MSGID_VERSION_SLAVE, REG_READ, 0x0101},
+};
+
+#define BOILER_LATE_RESPONSE 900 // response delay of late response fault in millis
+
+OpenthermBoiler::OpenthermBoiler() {
+  for (byte i = 0; i < OT_BOILER_REGISTERS; i++) {
+    _values[i] = boilerRegisters[i].value;
+  }
+  _responseDelay = 100;
+  setFaults(0, 0, 0, 0);
+  setSeed(1);
+  _requests = 0;
+  _unknown = 0;
+  _faults = 0;
+}
+
+void OpenthermBoiler::setResponseDelay(unsigned int delay) {
+  _responseDelay = delay;
+}
+
+void OpenthermBoiler::setFaults(byte noResponse, byte lateResponse, byte dataInvalid, byte boilerFault) {
+  _faultNoResponse = noResponse;
+  _faultLateResponse = lateResponse;
+  _faultDataInvalid = dataInvalid;
+  _faultBoiler = boilerFault;
+}
+
+void OpenthermBoiler::setSeed(unsigned long seed) {
+  _seed = seed != 0 ? seed : 1; // xorshift never leaves zero
+}
+
+long OpenthermBoiler::respond(OpenthermData &request, OpenthermData &response) {
+  _requests++;
+  _simulate(request);
+  response = request;
+
+  if (_inject(_faultNoResponse)) {
+    return OT_NO_RESPONSE;
+  }
+  long delay = _inject(_faultLateResponse) ? BOILER_LATE_RESPONSE : _responseDelay;
+
+  int reg = _find(request.id);
+  if (reg < 0) {
+    _unknown++;
+    response.type = OT_MSGTYPE_UNKNOWN_DATAID;
+    return delay;
+  }
+  if (_inject(_faultDataInvalid)) {
+    response.type = OT_MSGTYPE_DATA_INVALID;
+    return delay;
+  }
+
+  byte access = boilerRegisters[reg].access;
+  if (request.type == OT_MSGTYPE_READ_DATA && (access & REG_READ)) {
+    if (request.id == OT_MSGID_STATUS) {
+      response.valueLB = _values[reg] & 0xFF; // master flags in HB are echoed back
+    }
+    else {
+      response.u16(_values[reg]);
+    }
+    response.type = OT_MSGTYPE_READ_ACK;
+  }
+  else if (request.type == OT_MSGTYPE_WRITE_DATA && (access & REG_WRITE)) {
+    _values[reg] = request.u16();
+    response.type = OT_MSGTYPE_WRITE_ACK;
+  }
+  else {
+    response.type = OT_MSGTYPE_DATA_INVALID;
+  }
+  return delay;
+}
+
+unsigned long OpenthermBoiler::getRequests() {
+  return _requests;
+}
+
+unsigned long OpenthermBoiler::getUnknown() {
+  return _unknown;
+}
+
+unsigned long OpenthermBoiler::getFaults() {
+  return _faults;
+}
+
+int OpenthermBoiler::_find(byte id) {
+  for (byte i = 0; i < OT_BOILER_REGISTERS; i++) {
+    if (boilerRegisters[i].id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// xorshift pseudo random generator, so faults are reproducible and independent of platform
+bool OpenthermBoiler::_inject(byte percent) {
+  if (percent == 0) {
+    return false;
+  }
+  _seed ^= _seed << 13;
+  _seed ^= _seed >> 17;
+  _seed ^= _seed << 5;
+  if (_seed % 100 < percent) {
+    _faults++;
+    return true;
+  }
+  return false;
+}
+
+// very simple boiler physics, advanced with every status request
+void OpenthermBoiler::_simulate(OpenthermData &request) {
+  if (request.id != OT_MSGID_STATUS || request.type != OT_MSGTYPE_READ_DATA) {
+    return;
+  }
+  OpenthermData setpoint, feed, modulation;
+  setpoint.u16(_values[_find(OT_MSGID_CH_SETPOINT)]);
+  feed.u16(_values[_find(OT_MSGID_FEED_TEMP)]);
+
+  bool chEnabled = request.valueHB & 0x01;
+  bool fault = _inject(_faultBoiler);
+  bool flame = !fault && chEnabled && feed.f88() < setpoint.f88();
+  if (flame) {
+    feed.f88(feed.f88() + 0.5f);
+    modulation.f88(constrain((setpoint.f88() - feed.f88()) * 10, 0.0f, 100.0f));
+  }
+  else {
+    feed.f88(max(20.0f, feed.f88() - 0.1f));
+    modulation.f88(0);
+  }
+
+  _values[_find(OT_MSGID_STATUS)] = (fault ? 0x01 : 0x00) | (chEnabled ? 0x02 : 0x00) | (flame ? 0x08 : 0x00);
+  _values[_find(OT_MSGID_FAULT_FLAGS)] = fault ? 0x0100 : 0x0000; // service request
+  _values[_find(OT_MSGID_FEED_TEMP)] = feed.u16();
+  _values[_find(OT_MSGID_RETURN_WATER_TEMP)] = feed.u16() - 0x0A00; // 10 C below feed
+  _values[_find(OT_MSGID_MODULATION_LEVEL)] = modulation.u16();
+}
+
+struct ThermostatPoll {
+  byte type;
+  byte id;
+  unsigned int interval; // millis
+};
+
+// poll mix of emulated thermostat
+static const ThermostatPoll thermostatPolls[OT_THERMOSTAT_POLLS] = {
+  {OT_MSGTYPE_WRITE_DATA, OT_MSGID_CH_SETPOINT, 1000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_SLAVE_CONFIG, 60000},
+  {OT_MSGTYPE_WRITE_DATA, OT_MSGID_MASTER_CONFIG, 60000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_FAULT_FLAGS, 10000},
+  {OT_MSGTYPE_WRITE_DATA, OT_MSGID_MAX_MODULATION_LEVEL, 10000},
+  {OT_MSGTYPE_WRITE_DATA, OT_MSGID_ROOM_SETPOINT, 10000},
+  {OT_MSGTYPE_WRITE_DATA, OT_MSGID_ROOM_TEMP, 10000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_MODULATION_LEVEL, 2000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_CH_WATER_PRESSURE, 30000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_FEED_TEMP, 2000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_DHW_TEMP, 10000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_OUTSIDE_TEMP, 30000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_RETURN_WATER_TEMP, 10000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_DHW_BOUNDS, 60000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_CH_BOUNDS, 60000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_DHW_SETPOINT, 30000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_MAX_CH_SETPOINT, 30000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_BURNER_STARTS, 60000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_BURNER_HOURS, 60000},
+  {OT_MSGTYPE_WRITE_DATA, OT_MSGID_OT_VERSION_MASTER, 60000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_OT_VERSION_SLAVE, 60000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_VERSION_SLAVE, 60000},
+  {OT_MSGTYPE_READ_DATA, OT_MSGID_SOLAR_STORE_TEMP, 60000}, // not supported by emulated boiler
+};
+
+OpenthermThermostat::OpenthermThermostat() {
+  for (byte i = 0; i < OT_THERMOSTAT_POLLS; i++) {
+    _pollTimes[i] = 0;
+  }
+  _statusTurn = true;
+  _requestTime = 0;
+  _roomSetpoint = 21.0;
+  _roomTemp = 19.0;
+  _transactions = 0;
+  _timeouts = 0;
+  _unknown = 0;
+  _invalid = 0;
+  _totalResponseTime = 0;
+  _maxResponseTime = 0;
+}
+
+void OpenthermThermostat::request(OpenthermData &data, unsigned long now) {
+  _requestTime = now;
+  data.valueHB = 0;
+  data.valueLB = 0;
+
+  _statusTurn = !_statusTurn;
+  if (!_statusTurn) {
+    data.type = OT_MSGTYPE_READ_DATA;
+    data.id = OT_MSGID_STATUS;
+    data.valueHB = 0x03; // CH and DHW enabled
+    return;
+  }
+
+  byte next = 0;
+  long overdue = (long)(now - _pollTimes[0]) - thermostatPolls[0].interval;
+  for (byte i = 1; i < OT_THERMOSTAT_POLLS; i++) {
+    long candidate = (long)(now - _pollTimes[i]) - thermostatPolls[i].interval;
+    if (candidate > overdue) {
+      overdue = candidate;
+      next = i;
+    }
+  }
+  _pollTimes[next] = now;
+
+  data.type = thermostatPolls[next].type;
+  data.id = thermostatPolls[next].id;
+
+  if (data.type == OT_MSGTYPE_WRITE_DATA) {
+    if (data.id == OT_MSGID_CH_SETPOINT) {
+      data.f88(constrain(20 + (_roomSetpoint - _roomTemp) * 20, 20.0f, 80.0f)); // simple proportional control
+    }
+    else if (data.id == OT_MSGID_MAX_MODULATION_LEVEL) {
+      data.f88(100);
+    }
+    else if (data.id == OT_MSGID_ROOM_SETPOINT) {
+      data.f88(_roomSetpoint);
+    }
+    else if (data.id == OT_MSGID_ROOM_TEMP) {
+      _roomTemp += _roomTemp < _roomSetpoint ? 0.1f : -0.1f; // room follows heating demand
+      data.f88(_roomTemp);
+    }
+    else if (data.id == OT_MSGID_OT_VERSION_MASTER) {
+      data.f88(2.2);
+    }
+  }
+}
+
+void OpenthermThermostat::response(OpenthermData &data, unsigned long now) {
+  unsigned long duration = now - _requestTime;
+  _transactions++;
+  _totalResponseTime += duration;
+  _maxResponseTime = max(_maxResponseTime, duration);
+  if (data.type == OT_MSGTYPE_UNKNOWN_DATAID) {
+    _unknown++;
+  }
+  else if (data.type == OT_MSGTYPE_DATA_INVALID) {
+    _invalid++;
+  }
+}
+
+void OpenthermThermostat::timeout() {
+  _timeouts++;
+}
+
+unsigned long OpenthermThermostat::getTransactions() {
+  return _transactions;
+}
+
+unsigned long OpenthermThermostat::getTimeouts() {
+  return _timeouts;
+}
+
+unsigned long OpenthermThermostat::getUnknown() {
+  return _unknown;
+}
+
+unsigned long OpenthermThermostat::getInvalid() {
+  return _invalid;
+}
+
+unsigned long OpenthermThermostat::getAvgResponseTime() {
+  return _transactions > 0 ? _totalResponseTime / _transactions : 0;
+}
+
+unsigned long OpenthermThermostat::getMaxResponseTime() {
+  return _maxResponseTime;
+}
+
+#define VIRTUAL_FRAME_TIME 34     // 34 bits at 1ms per bit
+#define VIRTUAL_FRAME_SPACING 100 // minimal delay between end of response and next request
+#define VIRTUAL_TIMEOUT 800       // master gives up waiting for response
+
+OpenthermVirtualBus::OpenthermVirtualBus() {
+  _time = 0;
+  _frames = 0;
+  _errors = 0;
+  _noise = 0;
+  _seed = 1;
+}
+
+void OpenthermVirtualBus::setNoise(byte percent, unsigned long seed) {
+  _noise = percent;
+  _seed = seed != 0 ? seed : 1; // xorshift never leaves zero
+}
+
+unsigned long OpenthermVirtualBus::transaction(OpenthermThermostat &thermostat, OpenthermBoiler &boiler) {
+  unsigned long start = _time;
+  OpenthermData request, response;
+
+  thermostat.request(request, _time);
+  unsigned long frame = _transmit(OPENTHERM::encode(request));
+  _time += VIRTUAL_FRAME_TIME;
+  _frames++;
+
+  long delay = OT_NO_RESPONSE;
+  if (OPENTHERM::decode(frame, request)) {
+    delay = boiler.respond(request, response);
+  }
+  else {
+    _errors++;
+  }
+
+  if (delay == OT_NO_RESPONSE || delay >= VIRTUAL_TIMEOUT) { // late response is ignored by master
+    _time += VIRTUAL_TIMEOUT;
+    thermostat.timeout();
+  }
+  else {
+    frame = _transmit(OPENTHERM::encode(response));
+    _time += delay + VIRTUAL_FRAME_TIME;
+    _frames++;
+    if (OPENTHERM::decode(frame, response) && response.id == request.id) {
+      thermostat.response(response, _time);
+    }
+    else {
+      _errors++;
+      thermostat.timeout();
+    }
+  }
+  _time += VIRTUAL_FRAME_SPACING;
+  return _time - start;
+}
+
+unsigned long OpenthermVirtualBus::getTime() {
+  return _time;
+}
+
+unsigned long OpenthermVirtualBus::getFrames() {
+  return _frames;
+}
+
+unsigned long OpenthermVirtualBus::getErrors() {
+  return _errors;
+}
+
+// noisy line flips single random bit of the frame, so its parity check fails
+unsigned long OpenthermVirtualBus::_transmit(unsigned long frame) {
+  if (_noise == 0) {
+    return frame;
+  }
+  _seed ^= _seed << 13;
+  _seed ^= _seed >> 17;
+  _seed ^= _seed << 5;
+  if (_seed % 100 < _noise) {
+    frame ^= 1UL << ((_seed >> 8) % 32);
+  }
+  return frame;
+}
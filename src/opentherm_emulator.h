@@ -0,0 +1,165 @@
+#ifndef OPENTHERM_EMULATOR_H
+#define OPENTHERM_EMULATOR_H
+
+#include "opentherm.h"
+
+#define OT_BOILER_REGISTERS 24 // number of data IDs supported by emulated boiler
+#define OT_THERMOSTAT_POLLS 23 // number of data IDs in poll mix of emulated thermostat
+#define OT_NO_RESPONSE -1 // returned by OpenthermBoiler::respond() when request is left without response
+
+/**
+ * Emulated boiler (slave) with register model, configurable response delay, unsupported data IDs and injected faults.
+ * It does not touch any hardware, so it can answer requests received by OPENTHERM from real thermostat
+ * as well as requests exchanged over OpenthermVirtualBus in simulated time.
+ */
+class OpenthermBoiler {
+  public:
+    OpenthermBoiler();
+
+    /**
+     * @param delay delay between end of request and start of response in millis, Opentherm allows 20-800ms. Default is 100ms.
+     */
+    void setResponseDelay(unsigned int delay);
+
+    /**
+     * Configure injected faults, all in percents of requests. No faults are injected by default.
+     * 
+     * @param noResponse requests left without response (master should time out)
+     * @param lateResponse requests responded after 800ms limit
+     * @param dataInvalid supported requests responded with DataInvalid
+     * @param boilerFault status requests that raise boiler fault (cleared by next status request)
+     */
+    void setFaults(byte noResponse, byte lateResponse, byte dataInvalid, byte boilerFault);
+
+    /**
+     * Seed generator of injected faults, the same seed gives the same sequence of faults.
+     */
+    void setSeed(unsigned long seed);
+
+    /**
+     * Answer request of master according to register model. Every status request also advances very simple boiler physics
+     * (feed water heats up towards CH setpoint while central heating is enabled by master).
+     * 
+     * @param request data packet received from master
+     * @param response reference to data structure to which fill the response.
+     * @return delay in millis after which response should be sent, OT_NO_RESPONSE if it should not be sent at all.
+     */
+    long respond(OpenthermData &request, OpenthermData &response);
+
+    unsigned long getRequests();
+    unsigned long getUnknown(); // requests responded with UnknownId
+    unsigned long getFaults(); // injected faults
+
+  private:
+    uint16_t _values[OT_BOILER_REGISTERS];
+    unsigned int _responseDelay;
+    byte _faultNoResponse;
+    byte _faultLateResponse;
+    byte _faultDataInvalid;
+    byte _faultBoiler;
+    unsigned long _seed;
+    unsigned long _requests;
+    unsigned long _unknown;
+    unsigned long _faults;
+
+    int _find(byte id);
+    bool _inject(byte percent);
+    void _simulate(OpenthermData &request);
+};
+
+/**
+ * Emulated thermostat (master) running a realistic poll mix. Status is requested every other transaction
+ * (at least once per second as Opentherm requires), remaining transactions go to the data ID that is the most overdue.
+ * Like OpenthermBoiler it does not touch any hardware, time is passed in by caller so it can run in simulated time.
+ */
+class OpenthermThermostat {
+  public:
+    OpenthermThermostat();
+
+    /**
+     * Pick next request of the poll mix.
+     * 
+     * @param data reference to data structure to which fill the request.
+     * @param now current time in millis (real or simulated)
+     */
+    void request(OpenthermData &data, unsigned long now);
+
+    /**
+     * Pass response of slave to the last request.
+     * 
+     * @param data data packet received from slave
+     * @param now current time in millis (real or simulated)
+     */
+    void response(OpenthermData &data, unsigned long now);
+
+    /**
+     * Call when slave did not respond to the last request in time.
+     */
+    void timeout();
+
+    unsigned long getTransactions();
+    unsigned long getTimeouts();
+    unsigned long getUnknown(); // responses with UnknownId
+    unsigned long getInvalid(); // responses with DataInvalid
+    unsigned long getAvgResponseTime(); // from start of request to end of response in millis
+    unsigned long getMaxResponseTime();
+
+  private:
+    unsigned long _pollTimes[OT_THERMOSTAT_POLLS];
+    bool _statusTurn;
+    unsigned long _requestTime;
+    float _roomSetpoint;
+    float _roomTemp;
+    unsigned long _transactions;
+    unsigned long _timeouts;
+    unsigned long _unknown;
+    unsigned long _invalid;
+    unsigned long _totalResponseTime;
+    unsigned long _maxResponseTime;
+};
+
+/**
+ * Virtual Opentherm bus that exchanges frames between emulated thermostat and boiler without physical line.
+ * Requests and responses are packed to 32-bit frames by OPENTHERM::encode() and checked and unpacked by OPENTHERM::decode(),
+ * optionally with bit errors of noisy line. Manchester coding and bit timing are not simulated. Time is simulated:
+ * each transaction advances clock by the time it would take on real line (frames, response delay or timeout and frame spacing).
+ * That way hours of bus time run in seconds and many buses can be simulated at once.
+ */
+class OpenthermVirtualBus {
+  public:
+    OpenthermVirtualBus();
+
+    /**
+     * Simulate noisy line. No noise by default.
+     * 
+     * @param percent percentage of frames with single flipped bit, they fail parity check of decode().
+     * @param seed seed of noise generator, the same seed gives the same sequence of errors.
+     */
+    void setNoise(byte percent, unsigned long seed = 1);
+
+    /**
+     * Run single request/response transaction between given thermostat and boiler.
+     * 
+     * @return time in millis the transaction took on simulated bus.
+     */
+    unsigned long transaction(OpenthermThermostat &thermostat, OpenthermBoiler &boiler);
+
+    /**
+     * @return simulated time in millis since bus was created.
+     */
+    unsigned long getTime();
+
+    unsigned long getFrames(); // frames exchanged
+    unsigned long getErrors(); // frames that failed parity check (see setNoise()) or responses to different data ID
+
+  private:
+    unsigned long _time;
+    unsigned long _frames;
+    unsigned long _errors;
+    byte _noise;
+    unsigned long _seed;
+
+    unsigned long _transmit(unsigned long frame);
+};
+
+#endif